@@ -0,0 +1,151 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hattrib.h"
+#include "hlog.h"
+
+#include "util/memory_util.h"
+
+#include "ofxMeshEffect.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char* direction_names[] = { "in", "out" };
+
+// Indexed by HAPI_AttributeOwner
+static const char* owner_names[] = { "vertex", "point", "face", "detail" };
+
+void hattrib_init(HoudiniAttributeMap* map) {
+	map->count = 0;
+	map->capacity = 0;
+	map->mappings = NULL;
+}
+
+void hattrib_free(HoudiniAttributeMap* map) {
+	if (NULL != map->mappings) {
+		free_array(map->mappings);
+	}
+	hattrib_init(map);
+}
+
+// private
+static int find_token(const char** names, int count, const char* token, size_t len) {
+	for (int i = 0; i < count; ++i) {
+		if (strlen(names[i]) == len && 0 == strncmp(names[i], token, len)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// private
+static bool copy_name(char* dst, const char* src, size_t len) {
+	if (0 == len || len >= MOD_HOUDINI_MAX_ATTRIBUTE_NAME) {
+		return false;
+	}
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+	return true;
+}
+
+// private
+static bool hattrib_parse_entry(HoudiniAttributeMapping* mapping, const char* entry, size_t len) {
+	const char* end = entry + len;
+
+	const char* colon = memchr(entry, ':', len);
+	if (NULL == colon) return false;
+	int direction = find_token(direction_names, 2, entry, (size_t)(colon - entry));
+
+	const char* owner_start = colon + 1;
+	colon = memchr(owner_start, ':', (size_t)(end - owner_start));
+	if (NULL == colon) return false;
+	int owner = find_token(owner_names, 4, owner_start, (size_t)(colon - owner_start));
+
+	const char* source = colon + 1;
+	const char* arrow = memchr(source, '>', (size_t)(end - source));
+	if (-1 == direction || -1 == owner || NULL == arrow) return false;
+
+	mapping->direction = (HoudiniAttributeDirection)direction;
+	mapping->owner = (HAPI_AttributeOwner)owner;
+	char* source_name = HATTRIB_INPUT == direction ? mapping->host_name : mapping->houdini_name;
+	char* target_name = HATTRIB_INPUT == direction ? mapping->houdini_name : mapping->host_name;
+	return copy_name(source_name, source, (size_t)(arrow - source))
+		&& copy_name(target_name, arrow + 1, (size_t)(end - arrow - 1));
+}
+
+bool hattrib_parse(HoudiniAttributeMap* map, const char* spec) {
+	bool success = true;
+	while ('\0' != *spec) {
+		// Skip separators and surrounding spaces
+		spec += strspn(spec, "; \t\r\n");
+		size_t len = strcspn(spec, ";\r\n");
+		while (len > 0 && (' ' == spec[len - 1] || '\t' == spec[len - 1])) --len;
+		if (0 == len) {
+			continue;
+		}
+
+		if (map->count == map->capacity) {
+			int capacity = map->capacity > 0 ? 2 * map->capacity : 8;
+			HoudiniAttributeMapping* mappings = malloc_array(sizeof(HoudiniAttributeMapping), capacity, "houdini attribute map");
+			if (NULL != map->mappings) {
+				memcpy(mappings, map->mappings, sizeof(HoudiniAttributeMapping) * map->count);
+				free_array(map->mappings);
+			}
+			map->mappings = mappings;
+			map->capacity = capacity;
+		}
+
+		if (hattrib_parse_entry(&map->mappings[map->count], spec, len)) {
+			++map->count;
+		} else {
+			HLOG_WARNING(HLOG_GEO, "Invalid attribute mapping '%.*s'", (int)len, spec);
+			success = false;
+		}
+		spec += len;
+	}
+	return success;
+}
+
+const char* hattrib_owner_attachment(HAPI_AttributeOwner owner) {
+	switch (owner) {
+	case HAPI_ATTROWNER_POINT:
+		return kOfxMeshAttribPoint;
+	case HAPI_ATTROWNER_VERTEX:
+		return kOfxMeshAttribVertex;
+	case HAPI_ATTROWNER_PRIM:
+		return kOfxMeshAttribFace;
+	case HAPI_ATTROWNER_DETAIL:
+		return kOfxMeshAttribMesh;
+	default:
+		return NULL;
+	}
+}
+
+int hattrib_owner_element_count(HAPI_AttributeOwner owner, int point_count, int vertex_count, int face_count) {
+	switch (owner) {
+	case HAPI_ATTROWNER_POINT:
+		return point_count;
+	case HAPI_ATTROWNER_VERTEX:
+		return vertex_count;
+	case HAPI_ATTROWNER_PRIM:
+		return face_count;
+	case HAPI_ATTROWNER_DETAIL:
+		return 1;
+	default:
+		return 0;
+	}
+}
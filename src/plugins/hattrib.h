@@ -0,0 +1,94 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Table of the attributes transferred between the host mesh and Houdini, in
+ * addition to positions and topology. Each mapping gives a direction, the
+ * element an attribute is attached to and its name on both sides. Attributes
+ * of any int or float type and tuple size are supported.
+ *
+ * Assets may replace the default table, HATTRIB_DEFAULT_MAP, by declaring a
+ * string parameter named MOD_HOUDINI_ATTRIBUTE_MAP_PARM, whose default value
+ * lists mappings separated by ';' or new lines, each written as
+ *
+ *     direction:owner:source>target
+ *
+ * where direction is "in" (host to Houdini) or "out" (Houdini to host) and
+ * owner is one of "point", "vertex", "face" and "detail". For instance:
+ *
+ *     in:vertex:color0>Cd;out:point:N>normal0
+ */
+
+#ifndef H_HATTRIB
+#define H_HATTRIB
+
+#include "HAPI/HAPI.h"
+
+#include <stdbool.h>
+
+#define MOD_HOUDINI_ATTRIBUTE_MAP_PARM "mfx_attributes"
+#define MOD_HOUDINI_MAX_ATTRIBUTE_NAME 64
+
+// Colors and UVs of meshes, and the usual attributes of particles
+#define HATTRIB_DEFAULT_MAP \
+	"in:vertex:color0>Cd;in:vertex:uv0>uv;out:vertex:uv>uv0;" \
+	"out:point:v>v;out:point:pscale>pscale;out:point:id>id;out:point:Cd>Cd"
+
+// Appended to the default map unless disabled, so that the host does not
+// have to recompute normals, and keeps the hard edges authored in Houdini.
+// Point normals are expanded to vertices.
+#define HATTRIB_NORMAL_MAP "out:vertex:N>normal0"
+
+typedef enum HoudiniAttributeDirection {
+	HATTRIB_INPUT,
+	HATTRIB_OUTPUT,
+} HoudiniAttributeDirection;
+
+typedef struct HoudiniAttributeMapping {
+	HoudiniAttributeDirection direction;
+	HAPI_AttributeOwner owner;
+	char host_name[MOD_HOUDINI_MAX_ATTRIBUTE_NAME];
+	char houdini_name[MOD_HOUDINI_MAX_ATTRIBUTE_NAME];
+} HoudiniAttributeMapping;
+
+typedef struct HoudiniAttributeMap {
+	int count;
+	int capacity;
+	HoudiniAttributeMapping* mappings;
+} HoudiniAttributeMap;
+
+void hattrib_init(HoudiniAttributeMap* map);
+
+void hattrib_free(HoudiniAttributeMap* map);
+
+/**
+ * Append the mappings listed in spec (see syntax above) to the map. Invalid
+ * entries are skipped, in which case false is returned.
+ */
+bool hattrib_parse(HoudiniAttributeMap* map, const char* spec);
+
+/**
+ * Return the OFX attachment (kOfxMeshAttribPoint, etc.) matching a Houdini
+ * attribute owner.
+ */
+const char* hattrib_owner_attachment(HAPI_AttributeOwner owner);
+
+/**
+ * Number of elements of a mesh that attributes of the given owner have
+ */
+int hattrib_owner_element_count(HAPI_AttributeOwner owner, int point_count, int vertex_count, int face_count);
+
+#endif // H_HATTRIB
@@ -0,0 +1,241 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hcache.h"
+#include "hlog.h"
+
+#include "util/memory_util.h"
+#include "util/thread_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct HoudiniCacheEntry {
+	const void* owner;
+	int tag;
+	void* data;
+	size_t size;
+	size_t capacity;
+	int pin_count;
+	// LRU list, most recently used first
+	struct HoudiniCacheEntry* prev;
+	struct HoudiniCacheEntry* next;
+} HoudiniCacheEntry;
+
+typedef struct HoudiniCache {
+	Mutex* mutex;
+	HoudiniCacheEntry* first;
+	HoudiniCacheEntry* last;
+	size_t used;
+	size_t budget;
+} HoudiniCache;
+
+static HoudiniCache global_cache = { NULL, NULL, NULL, 0, 0 };
+
+void hcache_init(void) {
+	if (NULL != global_cache.mutex) {
+		return;
+	}
+
+	global_cache.mutex = mutex_create();
+	global_cache.budget = MOD_HOUDINI_DEFAULT_CACHE_BUDGET;
+
+	const char* env = getenv("MFX_HOUDINI_CACHE_BUDGET");
+	if (NULL != env) {
+		global_cache.budget = (size_t)strtoull(env, NULL, 10) * 1024 * 1024;
+		HLOG_INFO(HLOG_CACHE, "Houdini cache budget set to %zu bytes", global_cache.budget);
+	}
+}
+
+// private
+static HoudiniCacheEntry* hcache_find(const void* owner, int tag) {
+	for (HoudiniCacheEntry* entry = global_cache.first; NULL != entry; entry = entry->next) {
+		if (entry->owner == owner && entry->tag == tag) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+// private
+static void hcache_unlink(HoudiniCacheEntry* entry) {
+	if (NULL != entry->prev) entry->prev->next = entry->next;
+	else global_cache.first = entry->next;
+	if (NULL != entry->next) entry->next->prev = entry->prev;
+	else global_cache.last = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+// private
+static void hcache_push_front(HoudiniCacheEntry* entry) {
+	entry->prev = NULL;
+	entry->next = global_cache.first;
+	if (NULL != global_cache.first) global_cache.first->prev = entry;
+	else global_cache.last = entry;
+	global_cache.first = entry;
+}
+
+// private
+static void hcache_free_entry(HoudiniCacheEntry* entry) {
+	hcache_unlink(entry);
+	global_cache.used -= entry->capacity;
+	free_array(entry->data);
+	free_array(entry);
+}
+
+// private
+static void hcache_evict_until(size_t target) {
+	HoudiniCacheEntry* entry = global_cache.last;
+	while (global_cache.used > target && NULL != entry) {
+		HoudiniCacheEntry* prev = entry->prev;
+		if (0 == entry->pin_count) {
+			hcache_free_entry(entry);
+		}
+		entry = prev;
+	}
+}
+
+void hcache_set_budget(size_t budget) {
+	mutex_lock(global_cache.mutex);
+	global_cache.budget = budget;
+	hcache_evict_until(budget);
+	mutex_unlock(global_cache.mutex);
+}
+
+size_t hcache_get_budget(void) {
+	mutex_lock(global_cache.mutex);
+	size_t budget = global_cache.budget;
+	mutex_unlock(global_cache.mutex);
+	return budget;
+}
+
+size_t hcache_get_used(void) {
+	mutex_lock(global_cache.mutex);
+	size_t used = global_cache.used;
+	mutex_unlock(global_cache.mutex);
+	return used;
+}
+
+void* hcache_get(const void* owner, int tag, size_t* size_ptr) {
+	void* data = NULL;
+	mutex_lock(global_cache.mutex);
+
+	HoudiniCacheEntry* entry = hcache_find(owner, tag);
+	if (NULL != entry) {
+		hcache_unlink(entry);
+		hcache_push_front(entry);
+		entry->pin_count++;
+		data = entry->data;
+		if (NULL != size_ptr) *size_ptr = entry->size;
+	}
+
+	mutex_unlock(global_cache.mutex);
+	return data;
+}
+
+void* hcache_put(const void* owner, int tag, size_t size) {
+	void* data = NULL;
+	mutex_lock(global_cache.mutex);
+
+	HoudiniCacheEntry* entry = hcache_find(owner, tag);
+	if (NULL != entry && entry->capacity >= size) {
+		hcache_unlink(entry);
+		hcache_push_front(entry);
+		entry->pin_count++;
+		entry->size = size;
+		mutex_unlock(global_cache.mutex);
+		return entry->data;
+	}
+
+	// Previous allocation is too small, it will be replaced, unless someone
+	// still holds a pointer to it
+	if (NULL != entry) {
+		if (entry->pin_count > 0) {
+			HLOG_WARNING(HLOG_CACHE, "Cannot grow a Houdini cache buffer that is in use");
+			mutex_unlock(global_cache.mutex);
+			return NULL;
+		}
+		hcache_free_entry(entry);
+	}
+
+	if (size > global_cache.budget) {
+		mutex_unlock(global_cache.mutex);
+		return NULL;
+	}
+	hcache_evict_until(global_cache.budget - size);
+
+	if (global_cache.used + size <= global_cache.budget) {
+		entry = malloc_array(sizeof(HoudiniCacheEntry), 1, "houdini cache entry");
+		data = malloc_array(1, size, "houdini cache data");
+		if (NULL != entry && NULL != data) {
+			entry->owner = owner;
+			entry->tag = tag;
+			entry->data = data;
+			entry->size = size;
+			entry->capacity = size;
+			entry->pin_count = 1;
+			hcache_push_front(entry);
+			global_cache.used += size;
+		}
+		else {
+			free_array(entry);
+			free_array(data);
+			data = NULL;
+		}
+	}
+
+	mutex_unlock(global_cache.mutex);
+	return data;
+}
+
+void hcache_release(const void* owner, int tag) {
+	mutex_lock(global_cache.mutex);
+	HoudiniCacheEntry* entry = hcache_find(owner, tag);
+	if (NULL != entry && entry->pin_count > 0) {
+		entry->pin_count--;
+	}
+	mutex_unlock(global_cache.mutex);
+}
+
+void hcache_drop(const void* owner, int tag) {
+	mutex_lock(global_cache.mutex);
+	HoudiniCacheEntry* entry = hcache_find(owner, tag);
+	if (NULL != entry) {
+		hcache_free_entry(entry);
+	}
+	mutex_unlock(global_cache.mutex);
+}
+
+void hcache_drop_owner(const void* owner) {
+	mutex_lock(global_cache.mutex);
+	HoudiniCacheEntry* entry = global_cache.first;
+	while (NULL != entry) {
+		HoudiniCacheEntry* next = entry->next;
+		if (entry->owner == owner) {
+			hcache_free_entry(entry);
+		}
+		entry = next;
+	}
+	mutex_unlock(global_cache.mutex);
+}
+
+void hcache_shrink(size_t target) {
+	mutex_lock(global_cache.mutex);
+	size_t before = global_cache.used;
+	hcache_evict_until(target);
+	HLOG_DEBUG(HLOG_CACHE, "Houdini cache shrunk from %zu to %zu bytes", before, global_cache.used);
+	mutex_unlock(global_cache.mutex);
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Process-wide manager for all the memory that the plugin retains across
+ * actions. Every retained buffer is identified by an owner (a runtime or an
+ * instance) and a tag, and counts towards a byte budget that is enforced by
+ * evicting the least recently used buffers.
+ *
+ * Buffers returned by hcache_get() and hcache_put() are pinned, i.e. they
+ * cannot be evicted, until hcache_release() is called. Owners must hence be
+ * ready to find their buffer gone at the next hcache_get().
+ *
+ * The budget is read from the MFX_HOUDINI_CACHE_BUDGET environment variable,
+ * in megabytes, and defaults to MOD_HOUDINI_DEFAULT_CACHE_BUDGET.
+ */
+
+#ifndef H_HCACHE
+#define H_HCACHE
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define MOD_HOUDINI_DEFAULT_CACHE_BUDGET ((size_t)512 * 1024 * 1024)
+
+typedef enum HoudiniCacheTag {
+	HCACHE_STAGING_BUFFER,
+	HCACHE_PARM_SNAPSHOT,
+	HCACHE_OUTPUT_MESH,
+} HoudiniCacheTag;
+
+/**
+ * Create the lock of the cache and read its budget, to be called once before
+ * any thread uses it.
+ */
+void hcache_init(void);
+
+void hcache_set_budget(size_t budget);
+
+size_t hcache_get_budget(void);
+
+/**
+ * Number of bytes currently retained, pinned or not
+ */
+size_t hcache_get_used(void);
+
+/**
+ * Return the buffer retained for (owner, tag), or NULL if there is none or if
+ * it has been evicted. On success, size_ptr (if not null) receives the size
+ * that was requested in hcache_put() and the buffer is pinned.
+ */
+void* hcache_get(const void* owner, int tag, size_t* size_ptr);
+
+/**
+ * Retain a buffer of at least size bytes for (owner, tag), reusing the
+ * previous allocation when it is large enough. Content is preserved only when
+ * no reallocation is needed. The returned buffer is pinned. Return NULL if the
+ * buffer cannot fit in the budget even after eviction, if allocation fails, or
+ * if the previous allocation is too small but still pinned.
+ */
+void* hcache_put(const void* owner, int tag, size_t size);
+
+/**
+ * Unpin the buffer retained for (owner, tag), making it evictable again
+ */
+void hcache_release(const void* owner, int tag);
+
+/**
+ * Free the buffer retained for (owner, tag), regardless of pinning
+ */
+void hcache_drop(const void* owner, int tag);
+
+/**
+ * Free all the buffers retained for a given owner, regardless of pinning
+ */
+void hcache_drop_owner(const void* owner);
+
+/**
+ * Evict least recently used unpinned buffers until no more than target bytes
+ * are retained. hcache_shrink(0) is used as a response to kOfxActionPurgeCaches
+ * and to memory errors.
+ */
+void hcache_shrink(size_t target);
+
+#endif // H_HCACHE
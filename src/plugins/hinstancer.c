@@ -0,0 +1,179 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hinstancer.h"
+
+#include "util/thread_util.h"
+
+#include <string.h>
+
+void hinstancer_transform_matrices(const HAPI_Transform* transforms, int count, float* matrices) {
+	for (int i = 0; i < count; ++i) {
+		const HAPI_Transform* t = &transforms[i];
+		float* m = matrices + 12 * i;
+		float x = t->rotationQuaternion[0];
+		float y = t->rotationQuaternion[1];
+		float z = t->rotationQuaternion[2];
+		float w = t->rotationQuaternion[3];
+
+		// Columns of the rotation, scaled (scale is applied first)
+		m[0] = (1.0f - 2.0f * (y * y + z * z)) * t->scale[0];
+		m[1] = (2.0f * (x * y - z * w)) * t->scale[1];
+		m[2] = (2.0f * (x * z + y * w)) * t->scale[2];
+		m[4] = (2.0f * (x * y + z * w)) * t->scale[0];
+		m[5] = (1.0f - 2.0f * (x * x + z * z)) * t->scale[1];
+		m[6] = (2.0f * (y * z - x * w)) * t->scale[2];
+		m[8] = (2.0f * (x * z - y * w)) * t->scale[0];
+		m[9] = (2.0f * (y * z + x * w)) * t->scale[1];
+		m[10] = (1.0f - 2.0f * (x * x + y * y)) * t->scale[2];
+
+		m[3] = t->position[0];
+		m[7] = t->position[1];
+		m[11] = t->position[2];
+	}
+}
+
+// private
+static void transform_points(const float* src, int count, const float* m, char* dst, size_t stride) {
+	if (stride == 3 * sizeof(float)) {
+		// Tightly packed output, simple enough for the compiler to vectorize
+		float* out = (float*)dst;
+		for (int k = 0; k < count; ++k) {
+			float x = src[3 * k + 0], y = src[3 * k + 1], z = src[3 * k + 2];
+			out[3 * k + 0] = m[0] * x + m[1] * y + m[2] * z + m[3];
+			out[3 * k + 1] = m[4] * x + m[5] * y + m[6] * z + m[7];
+			out[3 * k + 2] = m[8] * x + m[9] * y + m[10] * z + m[11];
+		}
+		return;
+	}
+	for (int k = 0; k < count; ++k) {
+		float x = src[3 * k + 0], y = src[3 * k + 1], z = src[3 * k + 2];
+		float* out = (float*)(dst + stride * k);
+		out[0] = m[0] * x + m[1] * y + m[2] * z + m[3];
+		out[1] = m[4] * x + m[5] * y + m[6] * z + m[7];
+		out[2] = m[8] * x + m[9] * y + m[10] * z + m[11];
+	}
+}
+
+typedef struct ExpandTask {
+	const HoudiniInstanceSource* source;
+	const float* matrices;
+	int first_instance;
+	int last_instance; // excluded
+	Attribute point_data;
+	size_t first_point;
+	const Attribute* vertex_data;
+	size_t first_vertex;
+	const Attribute* face_data;
+	size_t first_face;
+} ExpandTask;
+
+// private
+static void expand_task_main(void* arg) {
+	const ExpandTask* task = (const ExpandTask*)arg;
+	const HoudiniInstanceSource* source = task->source;
+
+	for (int i = task->first_instance; i < task->last_instance; ++i) {
+		size_t copy_first_point = task->first_point + (size_t)source->point_count * i;
+		transform_points(
+			source->points, source->point_count, task->matrices + 12 * i,
+			task->point_data.data + task->point_data.stride * copy_first_point, task->point_data.stride);
+
+		if (NULL == task->vertex_data) {
+			continue;
+		}
+
+		const Attribute* vertex_data = task->vertex_data;
+		char* vertex_dst = vertex_data->data + vertex_data->stride * (task->first_vertex + (size_t)source->vertex_count * i);
+		int offset = (int)copy_first_point;
+		for (int k = 0; k < source->vertex_count; ++k) {
+			*(int*)(vertex_dst + vertex_data->stride * k) = offset + source->vertices[k];
+		}
+
+		const Attribute* face_data = task->face_data;
+		char* face_dst = face_data->data + face_data->stride * (task->first_face + (size_t)source->face_count * i);
+		if (face_data->stride == sizeof(int)) {
+			memcpy(face_dst, source->face_counts, sizeof(int) * source->face_count);
+		} else {
+			for (int k = 0; k < source->face_count; ++k) {
+				*(int*)(face_dst + face_data->stride * k) = source->face_counts[k];
+			}
+		}
+	}
+}
+
+void hinstancer_expand(const HoudiniInstanceSource* source,
+	const float* matrices, int instance_count,
+	Attribute point_data, size_t first_point,
+	const Attribute* vertex_data, size_t first_vertex,
+	const Attribute* face_data, size_t first_face) {
+	if (instance_count <= 0) {
+		return;
+	}
+
+	size_t total_points = (size_t)source->point_count * instance_count;
+	size_t thread_count = total_points / MOD_HOUDINI_EXPAND_GRAIN;
+	if (thread_count > MOD_HOUDINI_EXPAND_THREADS) thread_count = MOD_HOUDINI_EXPAND_THREADS;
+	if (thread_count > (size_t)instance_count) thread_count = (size_t)instance_count;
+	if (thread_count < 1) thread_count = 1;
+
+	ExpandTask tasks[MOD_HOUDINI_EXPAND_THREADS];
+	Thread* threads[MOD_HOUDINI_EXPAND_THREADS];
+	for (size_t t = 0; t < thread_count; ++t) {
+		ExpandTask* task = &tasks[t];
+		task->source = source;
+		task->matrices = matrices;
+		task->first_instance = (int)((size_t)instance_count * t / thread_count);
+		task->last_instance = (int)((size_t)instance_count * (t + 1) / thread_count);
+		task->point_data = point_data;
+		task->first_point = first_point;
+		task->vertex_data = vertex_data;
+		task->first_vertex = first_vertex;
+		task->face_data = face_data;
+		task->first_face = first_face;
+	}
+
+	// The calling thread takes the first range
+	for (size_t t = 1; t < thread_count; ++t) {
+		threads[t] = thread_start(expand_task_main, &tasks[t]);
+	}
+	expand_task_main(&tasks[0]);
+	for (size_t t = 1; t < thread_count; ++t) {
+		if (NULL != threads[t]) {
+			thread_join(threads[t]);
+		} else {
+			expand_task_main(&tasks[t]);
+		}
+	}
+}
+
+void hinstancer_replicate(Attribute attr, size_t first, size_t count, int instance_count) {
+	if (NULL == attr.data || 0 == count) {
+		return;
+	}
+	size_t element_size = attr.componentCount * attributeTypeByteSize(attr.type);
+	const char* src = attr.data + attr.stride * first;
+	for (int i = 1; i < instance_count; ++i) {
+		char* dst = attr.data + attr.stride * (first + count * i);
+		if (attr.stride == element_size) {
+			memcpy(dst, src, element_size * count);
+		} else {
+			for (size_t k = 0; k < count; ++k) {
+				memcpy(dst + attr.stride * k, src + attr.stride * k, element_size);
+			}
+		}
+	}
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Host side expansion of instancer parts. Houdini gives the geometry of each
+ * instanced part once, and one transform per instance. Copies are written
+ * right into the output buffers, in parallel over ranges of instances.
+ */
+
+#ifndef H_HINSTANCER
+#define H_HINSTANCER
+
+#include "util/plugin_support.h" // for Attribute
+
+#include "HAPI/HAPI.h"
+
+#include <stddef.h>
+
+// Maximum number of threads used to expand an instanced part
+#define MOD_HOUDINI_EXPAND_THREADS 8
+// Minimum number of points each of these threads writes
+#define MOD_HOUDINI_EXPAND_GRAIN 65536
+
+/**
+ * Mesh parts instanced by an instancer part, see hruntime_fetch_instancer.
+ * Element counts are per instance, summed over sources.
+ */
+typedef struct HoudiniInstancer {
+	int instance_count;
+	int source_count;
+	HAPI_PartInfo* source_infos;
+	size_t point_count;
+	size_t vertex_count;
+	size_t face_count;
+} HoudiniInstancer;
+
+/**
+ * Geometry of an instanced part, as downloaded from Houdini
+ */
+typedef struct HoudiniInstanceSource {
+	int point_count;
+	int vertex_count;
+	int face_count;
+	const float* points; // tightly packed positions
+	const int* vertices; // vertex points, relative to the part
+	const int* face_counts;
+} HoudiniInstanceSource;
+
+/**
+ * Convert count HAPI transforms, in SRT order, into 3x4 row-major matrices
+ * (12 floats each). Shear is ignored.
+ */
+void hinstancer_transform_matrices(const HAPI_Transform* transforms, int count, float* matrices);
+
+/**
+ * Write instance_count copies of source into the output buffers, copy i
+ * being transformed by matrix i and starting at element first + i * count
+ * of each buffer. Topology is not written when vertex_data is NULL, in which
+ * case source->vertices and source->face_counts may be NULL as well.
+ */
+void hinstancer_expand(const HoudiniInstanceSource* source,
+	const float* matrices, int instance_count,
+	Attribute point_data, size_t first_point,
+	const Attribute* vertex_data, size_t first_vertex,
+	const Attribute* face_data, size_t first_face);
+
+/**
+ * Copy the count elements of attr starting at first to the instance_count - 1
+ * ranges of count elements that follow them.
+ */
+void hinstancer_replicate(Attribute attr, size_t first, size_t count, int instance_count);
+
+#endif // H_HINSTANCER
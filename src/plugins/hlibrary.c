@@ -0,0 +1,201 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hlibrary.h"
+#include "hlog.h"
+
+#include "util/memory_util.h"
+#include "util/thread_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static Mutex* global_registry_mutex = NULL;
+static Condition* global_registry_condition = NULL; // signaled when a library is done loading
+static HoudiniLibrary* global_registry = NULL;
+
+void hlibrary_init(void) {
+	if (NULL == global_registry_mutex) {
+		global_registry_mutex = mutex_create();
+		global_registry_condition = condition_create();
+	}
+}
+
+// private
+static void hlibrary_lock() {
+	mutex_lock(global_registry_mutex);
+}
+
+// private
+static void hlibrary_unlock() {
+	mutex_unlock(global_registry_mutex);
+}
+
+void hlibrary_canonical_path(const char* path, char* canonical_path, size_t size) {
+#ifdef _WIN32
+	if (NULL == _fullpath(canonical_path, path, size)) {
+		strncpy(canonical_path, path, size - 1);
+	}
+#else // _WIN32
+	char* resolved = realpath(path, NULL);
+	strncpy(canonical_path, NULL != resolved ? resolved : path, size - 1);
+	free(resolved);
+#endif // _WIN32
+	canonical_path[size - 1] = '\0';
+}
+
+// private
+static bool hlibrary_fetch_asset_names(HoudiniLibrary* library, HAPI_StringHandle* asset_names_array) {
+	HAPI_Result res;
+
+	H_CHECK_LOG(HAPI_GetAvailableAssets(&library->session, library->library_id, asset_names_array, library->asset_count));
+
+	for (int i = 0; i < library->asset_count; ++i) {
+		char* name = library->asset_names + MOD_HOUDINI_MAX_ASSET_NAME * i;
+		H_CHECK_LOG(HAPI_GetString(&library->session, asset_names_array[i], name, MOD_HOUDINI_MAX_ASSET_NAME));
+	}
+
+	return true;
+}
+
+// private
+static bool hlibrary_load(HoudiniLibrary* library) {
+	HAPI_Result res;
+
+	HLOG_INFO(HLOG_SESSION, "Loading Houdini library %s...", library->path);
+
+	H_CHECK_LOG(HAPI_LoadAssetLibraryFromFile(&library->session, library->path, true, &library->library_id));
+
+	H_CHECK_LOG(HAPI_GetAvailableAssetCount(&library->session, library->library_id, &library->asset_count));
+
+	HAPI_StringHandle* asset_names_array = malloc_array(sizeof(HAPI_StringHandle), max(1, library->asset_count), "houdini asset names");
+	library->asset_names = malloc_array(MOD_HOUDINI_MAX_ASSET_NAME, max(1, library->asset_count), "houdini asset names");
+
+	bool ok = hlibrary_fetch_asset_names(library, asset_names_array);
+	free_array(asset_names_array);
+
+	if (!ok) {
+		free_array(library->asset_names);
+		library->asset_names = NULL;
+		library->asset_count = 0;
+	}
+	return ok;
+}
+
+HoudiniLibrary* hlibrary_acquire(const HAPI_Session* session, const char* path) {
+	char canonical_path[MAX_BUNDLE_DIRECTORY];
+	hlibrary_canonical_path(path, canonical_path, MAX_BUNDLE_DIRECTORY);
+
+	hlibrary_lock();
+
+	// Wait for a placeholder of the same library to be loaded (or dropped),
+	// so that two threads asking for it do not load it twice.
+	HoudiniLibrary* library = NULL;
+	for (;;) {
+		for (library = global_registry; NULL != library; library = library->next) {
+			if (library->session.type == session->type
+				&& library->session.id == session->id
+				&& 0 == strcmp(library->path, canonical_path)) {
+				break;
+			}
+		}
+		if (NULL == library || !library->is_loading) {
+			break;
+		}
+		condition_wait(global_registry_condition, global_registry_mutex, -1);
+	}
+
+	if (NULL != library) {
+		library->ref_count++;
+		hlibrary_unlock();
+		return library;
+	}
+
+	library = malloc_array(sizeof(HoudiniLibrary), 1, "houdini library");
+	strncpy(library->path, canonical_path, MAX_BUNDLE_DIRECTORY);
+	library->session = *session;
+	library->library_id = -1;
+	library->asset_count = 0;
+	library->asset_names = NULL;
+	library->ref_count = 1;
+	library->is_loading = true;
+	library->next = global_registry;
+	global_registry = library;
+
+	hlibrary_unlock();
+	bool ok = hlibrary_load(library);
+	hlibrary_lock();
+
+	library->is_loading = false;
+	if (!ok) {
+		HoudiniLibrary** link = &global_registry;
+		while (*link != library) {
+			link = &(*link)->next;
+		}
+		*link = library->next;
+		free_array(library);
+		library = NULL;
+	}
+	condition_broadcast(global_registry_condition);
+
+	hlibrary_unlock();
+	return library;
+}
+
+void hlibrary_release(HoudiniLibrary* library) {
+	// The library remains listed with no user, since its definitions stay
+	// in the session anyway. It is forgotten with its session.
+	hlibrary_lock();
+	library->ref_count--;
+	hlibrary_unlock();
+}
+
+// private
+static void hlibrary_free(HoudiniLibrary* library) {
+	HLOG_DEBUG(HLOG_SESSION, "Releasing Houdini library %s", library->path);
+	if (NULL != library->asset_names) {
+		free_array(library->asset_names);
+	}
+	free_array(library);
+}
+
+void hlibrary_forget_session(const HAPI_Session* session) {
+	hlibrary_lock();
+
+	// Libraries still loading belong to the thread loading them, which is
+	// using the session and thus keeps it open until it is done.
+	HoudiniLibrary** link = &global_registry;
+	while (NULL != *link) {
+		HoudiniLibrary* library = *link;
+		if (library->session.type == session->type && library->session.id == session->id && !library->is_loading) {
+			if (library->ref_count > 0) {
+				HLOG_WARNING(HLOG_SESSION, "Houdini library %s still has %d user(s) while its session is closed", library->path, library->ref_count);
+			}
+			*link = library->next;
+			hlibrary_free(library);
+		}
+		else {
+			link = &library->next;
+		}
+	}
+
+	hlibrary_unlock();
+}
+
+const char* hlibrary_asset_name(const HoudiniLibrary* library, int asset_index) {
+	return library->asset_names + MOD_HOUDINI_MAX_ASSET_NAME * asset_index;
+}
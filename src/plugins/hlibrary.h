@@ -0,0 +1,79 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Process-wide registry of loaded asset libraries. A library is loaded once
+ * per session, no matter how many plugins (i.e. assets) use it, and its
+ * asset names are resolved once for all.
+ */
+
+#ifndef H_HLIBRARY
+#define H_HLIBRARY
+
+#include "houdini_utils.h"
+
+#include "HAPI/HAPI.h"
+
+#include <stdbool.h>
+
+typedef struct HoudiniLibrary {
+	char path[MAX_BUNDLE_DIRECTORY]; // canonical path, used as key with session
+	HAPI_Session session;
+	HAPI_AssetLibraryId library_id;
+	int asset_count;
+	char* asset_names; // asset_count names of MOD_HOUDINI_MAX_ASSET_NAME chars
+	int ref_count;
+	bool is_loading; // listed as a placeholder while the first user loads it
+	struct HoudiniLibrary* next;
+} HoudiniLibrary;
+
+/**
+ * Create the lock of the registry, to be called once before any thread
+ * uses it.
+ */
+void hlibrary_init(void);
+
+/**
+ * Get the library located at path for a given session, loading it if this
+ * is its first user. Return NULL if the library could not be loaded.
+ * Must be balanced with a call to hlibrary_release(). The registry is not
+ * locked while loading, so different libraries load concurrently.
+ */
+HoudiniLibrary* hlibrary_acquire(const HAPI_Session* session, const char* path);
+
+/**
+ * Release a library acquired with hlibrary_acquire(). NB: HAPI has no way
+ * to unload an asset definition, it remains in the session until the
+ * session is cleaned up, so the library remains listed and can be acquired
+ * again at no cost until hlibrary_forget_session() is called.
+ */
+void hlibrary_release(HoudiniLibrary* library);
+
+/**
+ * Forget all libraries loaded in a session, to be called when the session
+ * is closed.
+ */
+void hlibrary_forget_session(const HAPI_Session* session);
+
+const char* hlibrary_asset_name(const HoudiniLibrary* library, int asset_index);
+
+/**
+ * Resolve path into an absolute path without symlinks nor ".." so that it
+ * can be used as a key. Fall back to the path itself if it does not exist.
+ */
+void hlibrary_canonical_path(const char* path, char* canonical_path, size_t size);
+
+#endif // H_HLIBRARY
@@ -0,0 +1,203 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hlog.h"
+
+#include "util/thread_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#if defined(_MSC_VER)
+#define HLOG_THREAD_LOCAL __declspec(thread)
+#else
+#define HLOG_THREAD_LOCAL __thread
+#endif
+
+typedef struct HoudiniLogRecord {
+	// Number of the message plus one once fully written, 0 while being written
+	volatile unsigned int sequence;
+	int cook;
+	HoudiniLogLevel level;
+	HoudiniLogCategory category;
+	bool printed;
+	char message[HLOG_MAX_MESSAGE];
+} HoudiniLogRecord;
+
+typedef struct HoudiniLog {
+	HoudiniLogLevel levels[HLOG_CATEGORY_COUNT]; // printed levels
+	HoudiniLogLevel ring_level;
+	volatile int cook; // number of the last cook that started
+	// Writers reserve a record by incrementing head, no lock is involved. It
+	// wraps around, so records are only ever addressed through HLOG_RING_MASK.
+	volatile unsigned int head;
+	HoudiniLogRecord ring[HLOG_RING_SIZE];
+} HoudiniLog;
+
+#define HLOG_RING_MASK (HLOG_RING_SIZE - 1)
+
+static HoudiniLog global_log;
+
+// Cook run by the current thread, cooks of different instances may run
+// concurrently, 0 for messages logged outside of any cook
+static HLOG_THREAD_LOCAL int current_cook = 0;
+
+static const char* level_names[] = { "error", "warning", "info", "debug", "trace" };
+static const char* category_names[] = { "session", "parm", "cook", "geo", "cache" };
+
+// private
+static int find_name(const char** names, int count, const char* name, size_t len) {
+	for (int i = 0; i < count; ++i) {
+		if (strlen(names[i]) == len && 0 == strncmp(names[i], name, len)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// private
+static void hlog_parse_setting(const char* setting, size_t len) {
+	const char* equal = memchr(setting, '=', len);
+	if (NULL == equal) {
+		int level = find_name(level_names, HLOG_LEVEL_TRACE + 1, setting, len);
+		if (-1 == level) {
+			fprintf(stderr, "Unknown log level '%.*s'\n", (int)len, setting);
+			return;
+		}
+		for (int c = 0; c < HLOG_CATEGORY_COUNT; ++c) {
+			global_log.levels[c] = (HoudiniLogLevel)level;
+		}
+		return;
+	}
+
+	size_t category_len = (size_t)(equal - setting);
+	int category = find_name(category_names, HLOG_CATEGORY_COUNT, setting, category_len);
+	int level = find_name(level_names, HLOG_LEVEL_TRACE + 1, equal + 1, len - category_len - 1);
+	if (-1 == category || -1 == level) {
+		fprintf(stderr, "Unknown log setting '%.*s'\n", (int)len, setting);
+		return;
+	}
+	global_log.levels[category] = (HoudiniLogLevel)level;
+}
+
+void hlog_init(void) {
+	for (int c = 0; c < HLOG_CATEGORY_COUNT; ++c) {
+		global_log.levels[c] = HLOG_LEVEL_INFO;
+	}
+	global_log.ring_level = HLOG_LEVEL_DEBUG;
+
+	const char* env = getenv("MFX_HOUDINI_LOG");
+	while (NULL != env && '\0' != *env) {
+		size_t len = strcspn(env, ",");
+		if (len > 0) {
+			hlog_parse_setting(env, len);
+		}
+		env += len;
+		if (',' == *env) ++env;
+	}
+
+	env = getenv("MFX_HOUDINI_LOG_RING");
+	if (NULL != env) {
+		int level = find_name(level_names, HLOG_LEVEL_TRACE + 1, env, strlen(env));
+		if (-1 != level) {
+			global_log.ring_level = (HoudiniLogLevel)level;
+		}
+	}
+}
+
+bool hlog_enabled(HoudiniLogLevel level, HoudiniLogCategory category) {
+	return level <= global_log.levels[category] || level <= global_log.ring_level;
+}
+
+// private
+static void hlog_print(HoudiniLogLevel level, HoudiniLogCategory category, const char* message) {
+	FILE* stream = level <= HLOG_LEVEL_WARNING ? stderr : stdout;
+	fprintf(stream, "[houdini %s %s] %s\n", category_names[category], level_names[level], message);
+}
+
+void hlog_write(HoudiniLogLevel level, HoudiniLogCategory category, const char* fmt, ...) {
+	char message[HLOG_MAX_MESSAGE];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(message, HLOG_MAX_MESSAGE, fmt, args);
+	va_end(args);
+
+	// Messages used to be plain printf calls, tolerate their trailing newline
+	size_t len = strlen(message);
+	if (len > 0 && '\n' == message[len - 1]) {
+		message[len - 1] = '\0';
+	}
+
+	bool printed = level <= global_log.levels[category];
+	if (printed) {
+		hlog_print(level, category, message);
+	}
+
+	if (level <= global_log.ring_level) {
+		unsigned int index = (unsigned int)interlocked_increment((volatile int*)&global_log.head) - 1;
+		HoudiniLogRecord* record = &global_log.ring[index & HLOG_RING_MASK];
+		record->sequence = 0;
+		memory_barrier();
+		record->cook = current_cook;
+		record->level = level;
+		record->category = category;
+		record->printed = printed;
+		memcpy(record->message, message, HLOG_MAX_MESSAGE);
+		memory_barrier();
+		record->sequence = index + 1;
+	}
+}
+
+int hlog_begin_cook(void) {
+	current_cook = interlocked_increment(&global_log.cook);
+	return current_cook;
+}
+
+void hlog_dump_cook(int cook) {
+	unsigned int head = global_log.head;
+	unsigned int count = head < HLOG_RING_SIZE ? head : HLOG_RING_SIZE;
+	bool has_header = false;
+
+	for (unsigned int n = count; n > 0; --n) {
+		unsigned int index = head - n;
+		const HoudiniLogRecord* slot = &global_log.ring[index & HLOG_RING_MASK];
+		HoudiniLogRecord record;
+
+		// Copy the record and check that it was not overwritten meanwhile
+		if (slot->sequence != index + 1) {
+			continue;
+		}
+		memory_barrier();
+		memcpy(&record, (const void*)slot, sizeof(HoudiniLogRecord));
+		memory_barrier();
+		if (slot->sequence != index + 1) {
+			continue;
+		}
+
+		if (record.cook != cook || record.printed) {
+			continue;
+		}
+		if (!has_header) {
+			fprintf(stderr, "Houdini log of cook #%d:\n", cook);
+			has_header = true;
+		}
+		record.message[HLOG_MAX_MESSAGE - 1] = '\0';
+		hlog_print(record.level, record.category, record.message);
+	}
+}
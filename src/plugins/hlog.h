@@ -0,0 +1,105 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Leveled and categorized logging. Messages are printed when their level
+ * is at most the level set for their category in the MFX_HOUDINI_LOG
+ * environment variable, which is a comma separated list of either a level,
+ * applying to all categories, or category=level. Levels are error, warning,
+ * info, debug and trace, and the default is info. For instance:
+ *
+ *     MFX_HOUDINI_LOG=warning,geo=debug
+ *
+ * Messages more verbose than HLOG_COMPILE_LEVEL are removed at compile time.
+ *
+ * Independently of what is printed, messages up to the level set by the
+ * MFX_HOUDINI_LOG_RING environment variable (debug by default) are kept in
+ * an in-memory ring buffer holding the last HLOG_RING_SIZE messages, which
+ * is dumped when a cook fails.
+ */
+
+#ifndef H_HLOG
+#define H_HLOG
+
+#include <stdbool.h>
+
+typedef enum HoudiniLogLevel {
+	HLOG_LEVEL_ERROR,
+	HLOG_LEVEL_WARNING,
+	HLOG_LEVEL_INFO,
+	HLOG_LEVEL_DEBUG,
+	HLOG_LEVEL_TRACE,
+} HoudiniLogLevel;
+
+typedef enum HoudiniLogCategory {
+	HLOG_SESSION, // session and library management
+	HLOG_PARM, // parameters
+	HLOG_COOK, // cooking and OFX actions
+	HLOG_GEO, // geometry transfer
+	HLOG_CACHE, // memory management
+	HLOG_CATEGORY_COUNT,
+} HoudiniLogCategory;
+
+#ifndef HLOG_COMPILE_LEVEL
+#ifdef NDEBUG
+#define HLOG_COMPILE_LEVEL HLOG_LEVEL_INFO
+#else // NDEBUG
+#define HLOG_COMPILE_LEVEL HLOG_LEVEL_TRACE
+#endif // NDEBUG
+#endif // HLOG_COMPILE_LEVEL
+
+#define HLOG_RING_SIZE 4096 // must be a power of two
+#define HLOG_MAX_MESSAGE 256
+
+#define HLOG(level, category, ...) \
+do { \
+	if ((level) <= HLOG_COMPILE_LEVEL && hlog_enabled((level), (category))) { \
+		hlog_write((level), (category), __VA_ARGS__); \
+	} \
+} while (0)
+
+#define HLOG_ERROR(category, ...) HLOG(HLOG_LEVEL_ERROR, category, __VA_ARGS__)
+#define HLOG_WARNING(category, ...) HLOG(HLOG_LEVEL_WARNING, category, __VA_ARGS__)
+#define HLOG_INFO(category, ...) HLOG(HLOG_LEVEL_INFO, category, __VA_ARGS__)
+#define HLOG_DEBUG(category, ...) HLOG(HLOG_LEVEL_DEBUG, category, __VA_ARGS__)
+#define HLOG_TRACE(category, ...) HLOG(HLOG_LEVEL_TRACE, category, __VA_ARGS__)
+
+/**
+ * Read the log settings from the environment, must be called once at load
+ * before any other thread logs
+ */
+void hlog_init(void);
+
+/**
+ * Whether a message must be either printed or kept in the ring buffer
+ */
+bool hlog_enabled(HoudiniLogLevel level, HoudiniLogCategory category);
+
+void hlog_write(HoudiniLogLevel level, HoudiniLogCategory category, const char* fmt, ...);
+
+/**
+ * Start a new cook in the ring buffer, return its number. Messages that the
+ * calling thread writes from then on belong to this cook.
+ */
+int hlog_begin_cook(void);
+
+/**
+ * Print messages of the given cook kept in the ring buffer, that were not
+ * printed already.
+ */
+void hlog_dump_cook(int cook);
+
+#endif // H_HLOG
@@ -0,0 +1,330 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hmanifest.h"
+#include "hlibrary.h"
+#include "hruntime.h"
+#include "hlog.h"
+
+#include "util/memory_util.h"
+#include "util/thread_util.h"
+#include "util/time_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define PATH_LIST_SEPARATOR ';'
+#else // _WIN32
+#include <dirent.h>
+#include <sys/stat.h>
+#define PATH_LIST_SEPARATOR ':'
+#endif // _WIN32
+
+#define MAX_LOADER_SESSIONS 16
+
+void hmanifest_init(HoudiniManifest* manifest) {
+	manifest->library_count = 0;
+	manifest->library_paths = NULL;
+	manifest->entry_count = 0;
+	manifest->entries = NULL;
+}
+
+void hmanifest_free(HoudiniManifest* manifest) {
+	if (NULL != manifest->library_paths) {
+		free_array(manifest->library_paths);
+	}
+	if (NULL != manifest->entries) {
+		free_array(manifest->entries);
+	}
+	hmanifest_init(manifest);
+}
+
+const char* hmanifest_library_path(const HoudiniManifest* manifest, int library_index) {
+	return manifest->library_paths + MAX_BUNDLE_DIRECTORY * library_index;
+}
+
+// private
+static bool is_library_file(const char* filename) {
+	static const char* extensions[] = { ".hda", ".otl", ".hdanc", ".otlnc", ".hdalc", ".otllc" };
+	const char* ext = strrchr(filename, '.');
+	if (NULL == ext) {
+		return false;
+	}
+	for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i) {
+		const char* a = ext;
+		const char* b = extensions[i];
+		while (*a && *b && tolower((unsigned char)*a) == *b) { ++a; ++b; }
+		if (*a == '\0' && *b == '\0') {
+			return true;
+		}
+	}
+	return false;
+}
+
+// private
+static void hmanifest_add_library(HoudiniManifest* manifest, const char* path) {
+	char canonical_path[MAX_BUNDLE_DIRECTORY];
+	hlibrary_canonical_path(path, canonical_path, MAX_BUNDLE_DIRECTORY);
+
+	for (int i = 0; i < manifest->library_count; ++i) {
+		if (0 == strcmp(hmanifest_library_path(manifest, i), canonical_path)) {
+			return;
+		}
+	}
+
+	char* paths = malloc_array(MAX_BUNDLE_DIRECTORY, manifest->library_count + 1, "houdini library paths");
+	if (NULL != manifest->library_paths) {
+		memcpy(paths, manifest->library_paths, MAX_BUNDLE_DIRECTORY * manifest->library_count);
+		free_array(manifest->library_paths);
+	}
+	manifest->library_paths = paths;
+	strncpy(manifest->library_paths + MAX_BUNDLE_DIRECTORY * manifest->library_count, canonical_path, MAX_BUNDLE_DIRECTORY);
+	manifest->library_count++;
+}
+
+// private
+static bool is_directory(const char* path) {
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributesA(path);
+	return INVALID_FILE_ATTRIBUTES != attributes && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else // _WIN32
+	struct stat st;
+	return 0 == stat(path, &st) && S_ISDIR(st.st_mode);
+#endif // _WIN32
+}
+
+// private
+static void hmanifest_scan_directory(HoudiniManifest* manifest, const char* directory) {
+	char path[MAX_BUNDLE_DIRECTORY];
+#ifdef _WIN32
+	WIN32_FIND_DATAA find_data;
+	snprintf(path, MAX_BUNDLE_DIRECTORY, "%s/*", directory);
+	HANDLE handle = FindFirstFileA(path, &find_data);
+	if (INVALID_HANDLE_VALUE == handle) {
+		return;
+	}
+	do {
+		if (!(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && is_library_file(find_data.cFileName)) {
+			snprintf(path, MAX_BUNDLE_DIRECTORY, "%s/%s", directory, find_data.cFileName);
+			hmanifest_add_library(manifest, path);
+		}
+	} while (FindNextFileA(handle, &find_data));
+	FindClose(handle);
+#else // _WIN32
+	DIR* dir = opendir(directory);
+	if (NULL == dir) {
+		return;
+	}
+	struct dirent* entry;
+	while (NULL != (entry = readdir(dir))) {
+		if (is_library_file(entry->d_name)) {
+			snprintf(path, MAX_BUNDLE_DIRECTORY, "%s/%s", directory, entry->d_name);
+			if (!is_directory(path)) {
+				hmanifest_add_library(manifest, path);
+			}
+		}
+	}
+	closedir(dir);
+#endif // _WIN32
+}
+
+// private
+static void hmanifest_scan_path(HoudiniManifest* manifest, const char* path) {
+	if (is_directory(path)) {
+		hmanifest_scan_directory(manifest, path);
+	}
+	else if (is_library_file(path)) {
+		hmanifest_add_library(manifest, path);
+	}
+}
+
+static int compare_library_paths(const void* a, const void* b) {
+	return strcmp((const char*)a, (const char*)b);
+}
+
+void hmanifest_scan(HoudiniManifest* manifest, const char* bundle_directory) {
+	char path[MAX_BUNDLE_DIRECTORY];
+
+	hmanifest_scan_directory(manifest, bundle_directory);
+
+	snprintf(path, MAX_BUNDLE_DIRECTORY, "%s/Contents/Resources", bundle_directory);
+	hmanifest_scan_directory(manifest, path);
+
+	const char* env = getenv("MFX_HOUDINI_LIBRARY_PATH");
+	while (NULL != env && '\0' != *env) {
+		const char* end = strchr(env, PATH_LIST_SEPARATOR);
+		size_t len = NULL != end ? (size_t)(end - env) : strlen(env);
+		if (len > 0 && len < MAX_BUNDLE_DIRECTORY) {
+			memcpy(path, env, len);
+			path[len] = '\0';
+			hmanifest_scan_path(manifest, path);
+		}
+		env = NULL != end ? end + 1 : NULL;
+	}
+
+	// Sorting makes plugin indices stable from one run to another
+	if (manifest->library_count > 1) {
+		qsort(manifest->library_paths, manifest->library_count, MAX_BUNDLE_DIRECTORY, compare_library_paths);
+	}
+}
+
+/**
+ * Shared state of the loader threads. Each thread owns a session and takes
+ * the next library to load from the queue until it is empty.
+ */
+typedef struct HoudiniManifestLoader {
+	HoudiniManifest* manifest;
+	Mutex* mutex;
+	int next_library;
+	// For each library, asset names as resolved by the library registry
+	int* asset_counts;
+	char** asset_names;
+} HoudiniManifestLoader;
+
+typedef struct HoudiniManifestWorker {
+	HoudiniManifestLoader* loader;
+	HAPI_Session session;
+	bool owns_session;
+	int index;
+} HoudiniManifestWorker;
+
+static void hmanifest_worker_main(void* arg) {
+	HoudiniManifestWorker* worker = (HoudiniManifestWorker*)arg;
+	HoudiniManifestLoader* loader = worker->loader;
+
+	if (worker->owns_session) {
+		char pipe_name[64];
+		snprintf(pipe_name, sizeof(pipe_name), "hapi_loader_%d", worker->index);
+		if (!hruntime_open_session(&worker->session, pipe_name, false /* threaded cooking */)) {
+			// Other workers will take care of the remaining libraries
+			worker->owns_session = false;
+			return;
+		}
+	}
+
+	for (;;) {
+		mutex_lock(loader->mutex);
+		int library_index = loader->next_library++;
+		mutex_unlock(loader->mutex);
+
+		if (library_index >= loader->manifest->library_count) {
+			break;
+		}
+
+		const char* path = hmanifest_library_path(loader->manifest, library_index);
+		HoudiniLibrary* library = hlibrary_acquire(&worker->session, path);
+		if (NULL == library) {
+			continue;
+		}
+
+		loader->asset_counts[library_index] = library->asset_count;
+		if (library->asset_count > 0) {
+			size_t size = (size_t)MOD_HOUDINI_MAX_ASSET_NAME * library->asset_count;
+			loader->asset_names[library_index] = malloc_array(1, size, "houdini manifest asset names");
+			memcpy(loader->asset_names[library_index], library->asset_names, size);
+		}
+
+		hlibrary_release(library);
+	}
+
+	if (worker->owns_session) {
+		hruntime_close_session(&worker->session);
+	}
+}
+
+void hmanifest_load(HoudiniManifest* manifest, const HAPI_Session* session, int session_count) {
+	double start_time = time_now_ms();
+
+	if (NULL != manifest->entries) {
+		free_array(manifest->entries);
+		manifest->entries = NULL;
+	}
+	manifest->entry_count = 0;
+
+	if (0 == manifest->library_count) {
+		HLOG_WARNING(HLOG_SESSION, "No Houdini library found");
+		return;
+	}
+
+#ifdef LOCAL_HSESSION
+	session_count = 1;
+#endif // LOCAL_HSESSION
+	session_count = max(1, min(min(session_count, manifest->library_count), MAX_LOADER_SESSIONS));
+
+	HoudiniManifestLoader loader;
+	loader.manifest = manifest;
+	loader.mutex = mutex_create();
+	loader.next_library = 0;
+	loader.asset_counts = malloc_array(sizeof(int), manifest->library_count, "houdini manifest asset counts");
+	loader.asset_names = malloc_array(sizeof(char*), manifest->library_count, "houdini manifest asset names");
+	for (int i = 0; i < manifest->library_count; ++i) {
+		loader.asset_counts[i] = 0;
+		loader.asset_names[i] = NULL;
+	}
+
+	HoudiniManifestWorker workers[MAX_LOADER_SESSIONS];
+	Thread* threads[MAX_LOADER_SESSIONS];
+	for (int k = 0; k < session_count; ++k) {
+		workers[k].loader = &loader;
+		workers[k].index = k;
+		workers[k].owns_session = k > 0;
+		if (0 == k) {
+			workers[k].session = *session;
+		}
+	}
+
+	// The first worker runs on the calling thread with the main session
+	for (int k = 1; k < session_count; ++k) {
+		threads[k] = thread_start(hmanifest_worker_main, &workers[k]);
+	}
+	hmanifest_worker_main(&workers[0]);
+	for (int k = 1; k < session_count; ++k) {
+		if (NULL != threads[k]) {
+			thread_join(threads[k]);
+		}
+	}
+
+	// Gather entries in library order, so that plugin indices do not depend
+	// on which library finished loading first.
+	int entry_count = 0;
+	for (int i = 0; i < manifest->library_count; ++i) {
+		entry_count += loader.asset_counts[i];
+	}
+	manifest->entries = malloc_array(sizeof(HoudiniManifestEntry), max(1, entry_count), "houdini manifest entries");
+	for (int i = 0; i < manifest->library_count; ++i) {
+		for (int j = 0; j < loader.asset_counts[i]; ++j) {
+			HoudiniManifestEntry* entry = &manifest->entries[manifest->entry_count++];
+			strncpy(entry->asset_name, loader.asset_names[i] + MOD_HOUDINI_MAX_ASSET_NAME * j, MOD_HOUDINI_MAX_ASSET_NAME - 1);
+			entry->asset_name[MOD_HOUDINI_MAX_ASSET_NAME - 1] = '\0';
+			entry->library_index = i;
+			entry->asset_index = j;
+		}
+		if (NULL != loader.asset_names[i]) {
+			free_array(loader.asset_names[i]);
+		}
+	}
+
+	free_array(loader.asset_counts);
+	free_array(loader.asset_names);
+	mutex_free(loader.mutex);
+
+	HLOG_INFO(HLOG_SESSION, "Loaded %d Houdini libraries (%d assets) in %.1f ms using %d session(s)",
+		manifest->library_count, manifest->entry_count, time_now_ms() - start_time, session_count);
+}
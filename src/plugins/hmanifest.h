@@ -0,0 +1,71 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * The manifest lists all the asset libraries available to the plugin and
+ * records, for each asset exposed as a plugin, which library it comes from.
+ * It is built once when the host asks for the number of plugins, and later
+ * used to only load the library of the plugins that are actually used.
+ *
+ * Libraries (.hda, .otl and their nc/lc variants) are looked for in the
+ * bundle directory, in its Contents/Resources subdirectory and in the files
+ * and directories listed in the MFX_HOUDINI_LIBRARY_PATH environment variable.
+ */
+
+#ifndef H_HMANIFEST
+#define H_HMANIFEST
+
+#include "houdini_utils.h"
+
+#include "HAPI/HAPI.h"
+
+#include <stdbool.h>
+
+#define MOD_HOUDINI_DEFAULT_LOADER_SESSIONS 2
+
+typedef struct HoudiniManifestEntry {
+	char asset_name[MOD_HOUDINI_MAX_ASSET_NAME];
+	int library_index;
+	int asset_index; // index of the asset within its library
+} HoudiniManifestEntry;
+
+typedef struct HoudiniManifest {
+	int library_count;
+	char* library_paths; // library_count paths of MAX_BUNDLE_DIRECTORY chars, sorted
+	int entry_count;
+	HoudiniManifestEntry* entries;
+} HoudiniManifest;
+
+void hmanifest_init(HoudiniManifest* manifest);
+
+void hmanifest_free(HoudiniManifest* manifest);
+
+/**
+ * Find all asset libraries, without loading them yet
+ */
+void hmanifest_scan(HoudiniManifest* manifest, const char* bundle_directory);
+
+/**
+ * Load all libraries to list their assets. The first session is the one
+ * given, additional ones are started to load independent libraries
+ * concurrently, up to session_count sessions in total.
+ * /pre hmanifest_scan has been called
+ */
+void hmanifest_load(HoudiniManifest* manifest, const HAPI_Session* session, int session_count);
+
+const char* hmanifest_library_path(const HoudiniManifest* manifest, int library_index);
+
+#endif // H_HMANIFEST
@@ -92,6 +92,8 @@ const char* houdini_to_ofx_type(HAPI_ParmType houdini_type, int size) {
 		default:
 			return NULL;
 		}
+	case HAPI_PARMTYPE_TOGGLE:
+		return 1 == size ? kOfxParamTypeBoolean : NULL;
 	case HAPI_PARMTYPE_COLOR:
 		switch (size) {
 		case 3:
@@ -20,31 +20,59 @@
 #include "HAPI/HAPI.h"
 #include "util/plugin_support.h"
 
+#include "hstats.h"
+#include "hlog.h"
+
+// Size of the table of entry points, set at build time (see CMakeLists.txt)
+#ifndef MAX_NUM_PLUGINS
 #define MAX_NUM_PLUGINS 10
+#endif
 #define MAX_BUNDLE_DIRECTORY 1024
 #define MOD_HOUDINI_MAX_ASSET_NAME 1024
 #define MOD_HOUDINI_MAX_PARAMETER_NAME 256
+#define MOD_HOUDINI_MAX_INPUT_NAME 256
+
+// OFX name of the inputs of an asset after the first one, which is the main
+// input, formatted with the 1-based index of the input
+#define MOD_HOUDINI_INPUT_NAME_FORMAT "Input%d"
 
 #define kOfxPropHoudiniNodeId "OfxPropHoudiniNodeId"
 
+// Parameter conventions used to declare that the asset is a no-op
+#define MOD_HOUDINI_IDENTITY_TAG "mfx_identity"
+#define MOD_HOUDINI_ENABLE_PARM "mfx_enable"
+// Float parameters meet an identity condition when this close to its values
+#define MOD_HOUDINI_IDENTITY_EPSILON 1e-6f
+
+// Float parameter giving the cook budget of an asset, in seconds
+#define MOD_HOUDINI_COOK_BUDGET_PARM "mfx_cook_budget"
+
 // A series of macros to automatically add debug info when calling either houdini of open mesh effect apis
 
 #define MFX_CHECK(op) status = runtime->op; \
 if (kOfxStatOK != status) {\
-printf("Suite method call '" #op "' returned status %d (%s)\n", status, getOfxStateName(status)); \
+HLOG_WARNING(HLOG_COOK, "Suite method call '" #op "' returned status %d (%s)", status, getOfxStateName(status)); \
 }
 #define MFX_CHECK2(op) status = op; \
 if (kOfxStatOK != status) {\
-printf("Suite method call '" #op "' returned status %d (%s)\n", status, getOfxStateName(status)); \
+HLOG_WARNING(HLOG_COOK, "Suite method call '" #op "' returned status %d (%s)", status, getOfxStateName(status)); \
 }
 
-#define H_CHECK(op) res = op; \
+// Calls are counted and timed through H_CALL, see hstats.h
+#define H_CHECK(op) res = H_CALL(op); \
 if (HAPI_RESULT_SUCCESS != res) { \
 	ERR("Houdini error during call '" #op "': %u (%s)\n", res, HAPI_ResultMessage(res)); \
 	return false; \
 }
 
-#define H_CHECK_OR(op) res = op; \
+// Same as H_CHECK, for code that has no HoudiniRuntime to report errors to
+#define H_CHECK_LOG(op) res = H_CALL(op); \
+if (HAPI_RESULT_SUCCESS != res) { \
+	HLOG_ERROR(HLOG_SESSION, "Houdini error during call '" #op "': %u (%s)", res, HAPI_ResultMessage(res)); \
+	return false; \
+}
+
+#define H_CHECK_OR(op) res = H_CALL(op); \
 if (HAPI_RESULT_SUCCESS != res) { \
 	ERR("Houdini error during call '" #op "': %u (%s)\n", res, HAPI_ResultMessage(res)); \
 } \
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hprofile.h"
+#include "hlog.h"
+
+#include "util/time_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct HoudiniProfileSettings {
+	int enabled; // -1 until the environment has been read
+	int period;
+	char directory[HPROFILE_MAX_PATH];
+} HoudiniProfileSettings;
+
+static HoudiniProfileSettings global_settings = { -1, 1, "" };
+
+void hprofile_init(void) {
+	if (-1 != global_settings.enabled) {
+		return;
+	}
+	const char* env = getenv("MFX_HOUDINI_PROFILE_DIR");
+	if (NULL != env && '\0' != env[0] && strlen(env) < HPROFILE_MAX_PATH) {
+		strcpy(global_settings.directory, env);
+		global_settings.enabled = 1;
+	} else {
+		global_settings.enabled = 0;
+	}
+	env = getenv("MFX_HOUDINI_PROFILE_PERIOD");
+	if (NULL != env && atoi(env) > 0) {
+		global_settings.period = atoi(env);
+	}
+}
+
+bool hprofile_enabled(void) {
+	return 1 == global_settings.enabled;
+}
+
+// private
+static void hprofile_sanitize(char* name) {
+	for (char* c = name; '\0' != *c; ++c) {
+		bool is_safe =
+			('a' <= *c && *c <= 'z') || ('A' <= *c && *c <= 'Z') || ('0' <= *c && *c <= '9')
+			|| '_' == *c || '-' == *c || '.' == *c;
+		if (!is_safe) {
+			*c = '_';
+		}
+	}
+}
+
+void hprofile_begin(HoudiniProfile* profile, const char* asset_name, int instance_id, double frame, int cook_index) {
+	profile->active = false;
+	profile->stage_count = 0;
+	profile->start_ms = time_now_ms();
+	profile->stage_start_ms = profile->start_ms;
+
+	if (!hprofile_enabled() || 0 != cook_index % global_settings.period) {
+		return;
+	}
+
+	char name[HPROFILE_MAX_PATH];
+	snprintf(name, sizeof(name), "%s_instance%d_frame%g_cook%d", NULL != asset_name ? asset_name : "asset", instance_id, frame, cook_index);
+	hprofile_sanitize(name);
+	int length = snprintf(profile->base_path, HPROFILE_MAX_PATH, "%s/%s", global_settings.directory, name);
+	if (length < 0 || length >= HPROFILE_MAX_PATH) {
+		HLOG_WARNING(HLOG_COOK, "Profile path too long, not capturing cook %d", cook_index);
+		return;
+	}
+	profile->active = true;
+}
+
+void hprofile_stage(HoudiniProfile* profile, const char* name) {
+	if (NULL == profile || !profile->active) {
+		return;
+	}
+	double now = time_now_ms();
+	if (profile->stage_count < HPROFILE_MAX_STAGES) {
+		profile->stage_names[profile->stage_count] = name;
+		profile->stage_ms[profile->stage_count] = now - profile->stage_start_ms;
+		++profile->stage_count;
+	}
+	profile->stage_start_ms = now;
+}
+
+void hprofile_path(const HoudiniProfile* profile, const char* extension, char* path, int size) {
+	snprintf(path, size, "%s.%s", profile->base_path, extension);
+}
+
+void hprofile_end(HoudiniProfile* profile, bool success) {
+	if (!profile->active) {
+		return;
+	}
+	profile->active = false;
+	double total_ms = time_now_ms() - profile->start_ms;
+
+	char path[HPROFILE_MAX_PATH + 8];
+	hprofile_path(profile, "txt", path, sizeof(path));
+	FILE* file = fopen(path, "w");
+	if (NULL == file) {
+		HLOG_WARNING(HLOG_COOK, "Could not write cook profile to %s", path);
+		return;
+	}
+
+	double staged_ms = 0.0;
+	fprintf(file, "Cook %s, stage timings in ms\n", success ? "succeeded" : "failed");
+	for (int i = 0; i < profile->stage_count; ++i) {
+		fprintf(file, "%-16s %12.3f\n", profile->stage_names[i], profile->stage_ms[i]);
+		staged_ms += profile->stage_ms[i];
+	}
+	fprintf(file, "%-16s %12.3f\n", "other", total_ms - staged_ms);
+	fprintf(file, "%-16s %12.3f\n", "total", total_ms);
+	fclose(file);
+
+	HLOG_INFO(HLOG_COOK, "Cook profile written to %s", path);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Opt-in capture of where the time of a cook goes. When the environment
+ * variable MFX_HOUDINI_PROFILE_DIR is set, every MFX_HOUDINI_PROFILE_PERIOD-th
+ * cook of each instance (every cook by default) is recorded in this
+ * directory as two files named after the asset, the instance and the frame:
+ *  - a .hperf file, written by the Houdini performance monitor while the
+ *    asset node cooks, giving the cost of each SOP of the asset;
+ *  - a .txt file with the time spent in each stage of the cook, including
+ *    the transfers made by the plugin around the Houdini cook.
+ */
+
+#ifndef H_HPROFILE
+#define H_HPROFILE
+
+#include <stdbool.h>
+
+#define HPROFILE_MAX_STAGES 16
+#define HPROFILE_MAX_PATH 1024
+
+typedef struct HoudiniProfile {
+	bool active; // whether this cook is captured
+	char base_path[HPROFILE_MAX_PATH]; // path of the files, without extension
+	double start_ms;
+	double stage_start_ms;
+	int stage_count;
+	const char* stage_names[HPROFILE_MAX_STAGES]; // static strings
+	double stage_ms[HPROFILE_MAX_STAGES];
+} HoudiniProfile;
+
+/**
+ * Read the settings from the environment, to be called once before any
+ * thread makes calls. Profiling is disabled until then.
+ */
+void hprofile_init(void);
+
+bool hprofile_enabled(void);
+
+/**
+ * Start timing a cook, which is only captured if it is the cook_index-th
+ * cook of its instance and cook_index is a multiple of the period.
+ */
+void hprofile_begin(HoudiniProfile* profile, const char* asset_name, int instance_id, double frame, int cook_index);
+
+/**
+ * Close the current stage of the cook, which is given name. Does nothing
+ * if profile is NULL or not active.
+ */
+void hprofile_stage(HoudiniProfile* profile, const char* name);
+
+/**
+ * Get the path of one of the capture files, given its extension
+ */
+void hprofile_path(const HoudiniProfile* profile, const char* extension, char* path, int size);
+
+/**
+ * Write the stage timings of a captured cook next to its .hperf file
+ */
+void hprofile_end(HoudiniProfile* profile, bool success);
+
+#endif // H_HPROFILE
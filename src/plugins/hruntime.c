@@ -16,59 +16,102 @@
 
 #include "hruntime.h"
 #include "houdini_utils.h"
+#include "hcache.h"
+#include "hprofile.h"
 #include "util/memory_util.h"
+#include "util/thread_util.h"
+#include "util/time_util.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
+#include <limits.h>
 #include <assert.h>
 
+// Attributes are transferred as 32 bit ints or floats
+#define MOD_HOUDINI_COMPONENT_SIZE sizeof(float)
+
  // Global session
 static HAPI_Session global_hsession;
 static int global_hsession_users = 0;
+static bool global_hsession_open = false;
+static bool global_hsession_threaded = false; // whether it cooks in its own thread
+static Mutex* global_hsession_mutex = NULL;
+static Condition* global_hsession_condition = NULL; // signaled on state change
+
+// With threaded cooking, the cook state polled by hruntime_wait_cook() is
+// that of the whole session. Node creations and cooks, including those of
+// pool threads and other runtimes, are serialized by this lock so that each
+// wait only sees, and may only interrupt, its own operation.
+static Mutex* global_cook_mutex = NULL;
+
+// Session boot: the session may be started in the background before the
+// first runtime needs it, in which case hruntime_init() waits for it.
+static Thread* global_boot_thread = NULL;
+static bool global_boot_pending = false;
+static bool global_boot_failed = false;
+
+// Session linger: once the last runtime is freed, the session is kept open
+// for a while in case a new one gets created soon after, and closed by the
+// linger thread when the deadline expires.
+static Thread* global_linger_thread = NULL;
+static double global_linger_deadline = 0.0; // 0 when not lingering
+
+// Number of instances created so far by all runtimes, gives them unique ids
+static volatile int global_instance_count = 0;
+
+static void hruntime_drain_pool(HoudiniRuntime* hr);
+static void hruntime_delete_merge_network(HoudiniRuntime* hr, HoudiniInstance* instance);
 
 void hruntime_set_error(HoudiniRuntime* hr, const char* fmt, ...) {
 	va_list args;
 	int len;
 
-	if (NULL == hr->error_message) {
-		free_array(hr->error_message);
-		hr->error_message = NULL;
-	}
-
 	va_start(args, fmt);
 	len = vsnprintf(NULL, 0, fmt, args);
 	va_end(args);
 
-	hr->error_message = malloc_array(sizeof(char), len + 1, "hruntime error message");
+	char* message = malloc_array(sizeof(char), len + 1, "hruntime error message");
 
 	va_start(args, fmt);
-	vsprintf(hr->error_message, fmt, args);
+	vsprintf(message, fmt, args);
 	va_end(args);
 
-	fprintf(stderr, "Houdini Runtime error: %s", hr->error_message);
+	HLOG_ERROR(HLOG_COOK, "Houdini Runtime error: %s", message);
+
+	// The pool thread reports errors too, see hruntime_build_node()
+	mutex_lock(hr->pool_mutex);
+	char* previous_message = hr->error_message;
+	hr->error_message = message;
+	mutex_unlock(hr->pool_mutex);
+
+	if (NULL != previous_message) {
+		free_array(previous_message);
+	}
 }
 
 #ifdef LOCAL_HSESSION
-static bool houdini_session_init(HoudiniRuntime* hr)
+bool hruntime_open_session(HAPI_Session* session, const char* pipe_name, bool threaded_cooking)
 {
 	HAPI_Result res;
 	HAPI_CookOptions cookOptions;
 	cookOptions.maxVerticesPerPrimitive = -1;
 
-	printf("Creating Houdini Session\n");
+	HLOG_INFO(HLOG_SESSION, "Creating Houdini Session");
 
-	H_CHECK(HAPI_CreateInProcessSession(&global_hsession));
+	H_CHECK_LOG(HAPI_CreateInProcessSession(session));
 
-	H_CHECK_OR(HAPI_Initialize(&global_hsession, &cookOptions, false /* threaded cooking */, -1, NULL, NULL, NULL, NULL, NULL))
-	{
-		if (HAPI_RESULT_ALREADY_INITIALIZED != res)
-			return false;
+	res = H_CALL(HAPI_Initialize(session, &cookOptions, threaded_cooking, -1, NULL, NULL, NULL, NULL, NULL));
+	if (HAPI_RESULT_SUCCESS != res && HAPI_RESULT_ALREADY_INITIALIZED != res) {
+		HLOG_ERROR(HLOG_SESSION, "Houdini error during call 'HAPI_Initialize': %u (%s)", res, HAPI_ResultMessage(res));
+		return false;
 	}
 
 	return true;
 }
 #else // LOCAL_HSESSION
-static bool houdini_session_init(HoudiniRuntime* hr)
+bool hruntime_open_session(HAPI_Session* session, const char* pipe_name, bool threaded_cooking)
 {
 	HAPI_Result res;
 
@@ -77,19 +120,19 @@ static bool houdini_session_init(HoudiniRuntime* hr)
 	serverOptions.autoClose = true;
 	serverOptions.timeoutMs = 3000.0f;
 
-	// Start our HARS server using the "hapi" named pipe
+	// Start our HARS server using the given named pipe
 	// This call can be ignored if you have launched HARS manually before
-	H_CHECK(HAPI_StartThriftNamedPipeServer(&serverOptions, "hapi", NULL));
+	H_CHECK_LOG(HAPI_StartThriftNamedPipeServer(&serverOptions, pipe_name, NULL));
 
 	// Create a new HAPI session to use with that server
-	H_CHECK(HAPI_CreateThriftNamedPipeSession(&global_hsession, "hapi"));
+	H_CHECK_LOG(HAPI_CreateThriftNamedPipeSession(session, pipe_name));
 
 	// Initialize HAPI
 	HAPI_CookOptions cookOptions = HAPI_CookOptions_Create();
-	H_CHECK(HAPI_Initialize(
-		&global_hsession,           // session
+	H_CHECK_LOG(HAPI_Initialize(
+		session,           // session
 		&cookOptions,       // cook options
-		false,                       // use_cooking_thread
+		threaded_cooking,            // use_cooking_thread
 		-1,                         // cooking_thread_stack_size
 		"",                         // houdini_environment_files
 		NULL,            // otl_search_path
@@ -101,151 +144,683 @@ static bool houdini_session_init(HoudiniRuntime* hr)
 }
 #endif // else LOCAL_HSESSION
 
-bool hruntime_init(HoudiniRuntime* hr) {
+void hruntime_close_session(HAPI_Session* session)
+{
 	HAPI_Result res;
 
-	if (0 == global_hsession_users) {
-		if (!houdini_session_init(hr)) return false;
+	HLOG_INFO(HLOG_SESSION, "Releasing Houdini Session");
+
+	res = H_CALL(HAPI_Cleanup(session));
+	if (HAPI_RESULT_SUCCESS != res) {
+		HLOG_ERROR(HLOG_SESSION, "Houdini error during call 'HAPI_Cleanup': %u (%s)", res, HAPI_ResultMessage(res));
+	}
+#ifndef LOCAL_HSESSION
+	HAPI_CloseSession(session);
+#endif // LOCAL_HSESSION
+
+	hlibrary_forget_session(session);
+}
+
+/**
+ * /pre session is locked
+ */
+static void hruntime_close_global_session() {
+	hruntime_close_session(&global_hsession);
+	global_hsession_open = false;
+	hstats_dump(HSTATS_SESSION, "session");
+}
+
+// private
+static int hruntime_linger_duration_ms() {
+	const char* env = getenv("MFX_HOUDINI_SESSION_LINGER");
+	if (NULL != env) {
+		return max(0, (int)(1000.0 * atof(env)));
+	}
+	return 1000 * MOD_HOUDINI_DEFAULT_SESSION_LINGER;
+}
+
+/**
+ * Default cook budget, read from MFX_HOUDINI_COOK_BUDGET. Cooks can only be
+ * interrupted when Houdini cooks in its own thread, so the global session is
+ * started with threaded cooking when this is not 0.
+ */
+static int hruntime_default_cook_budget_ms() {
+	const char* env = getenv("MFX_HOUDINI_COOK_BUDGET");
+	if (NULL != env) {
+		return max(0, (int)(1000.0 * atof(env)));
+	}
+	return 0;
+}
+
+static void hruntime_linger_main(void* arg) {
+	(void)arg;
+	mutex_lock(global_hsession_mutex);
+	while (global_linger_deadline > 0.0) {
+		double remaining = global_linger_deadline - time_now_ms();
+		if (remaining <= 0.0) {
+			HLOG_DEBUG(HLOG_SESSION, "Houdini session unused for too long");
+			hruntime_close_global_session();
+			global_linger_deadline = 0.0;
+			break;
+		}
+		condition_wait(global_hsession_condition, global_hsession_mutex, (int)remaining + 1);
+	}
+	mutex_unlock(global_hsession_mutex);
+}
+
+// private
+static void hruntime_lock_session() {
+	if (NULL == global_hsession_mutex) {
+		global_hsession_mutex = mutex_create();
+		global_hsession_condition = condition_create();
+		global_cook_mutex = mutex_create();
+	}
+	mutex_lock(global_hsession_mutex);
+}
+
+/**
+ * Stop the linger thread, if any. The session is then either still open and
+ * no longer lingering, or has been closed by the thread.
+ */
+static void hruntime_stop_linger() {
+	hruntime_lock_session();
+	Thread* thread = global_linger_thread;
+	global_linger_thread = NULL;
+	global_linger_deadline = 0.0;
+	condition_broadcast(global_hsession_condition);
+	mutex_unlock(global_hsession_mutex);
+
+	if (NULL != thread) {
+		thread_join(thread);
+	}
+}
+
+static void hruntime_boot_main(void* arg) {
+	(void)arg;
+	double start_time = time_now_ms();
+	HAPI_Session session;
+	bool threaded = hruntime_default_cook_budget_ms() > 0;
+	bool ok = hruntime_open_session(&session, "hapi", threaded);
+
+	mutex_lock(global_hsession_mutex);
+	if (ok) {
+		global_hsession = session;
+		global_hsession_open = true;
+		global_hsession_threaded = threaded;
+		HLOG_INFO(HLOG_SESSION, "Houdini session ready after %.1f ms", time_now_ms() - start_time);
+	}
+	global_boot_failed = !ok;
+	global_boot_pending = false;
+	condition_broadcast(global_hsession_condition);
+	mutex_unlock(global_hsession_mutex);
+}
+
+void hruntime_boot_session() {
+	hruntime_lock_session();
+	if (!global_hsession_open && !global_boot_pending && NULL == global_boot_thread) {
+		global_boot_pending = true;
+		global_boot_failed = false;
+		global_boot_thread = thread_start(hruntime_boot_main, NULL);
+		if (NULL == global_boot_thread) {
+			// The first runtime will open the session synchronously
+			global_boot_pending = false;
+		}
+	}
+	mutex_unlock(global_hsession_mutex);
+}
+
+// private
+static int hruntime_boot_timeout_ms() {
+	const char* env = getenv("MFX_HOUDINI_BOOT_TIMEOUT");
+	if (NULL != env) {
+		return max(0, (int)(1000.0 * atof(env)));
+	}
+	return 1000 * MOD_HOUDINI_DEFAULT_BOOT_TIMEOUT;
+}
+
+/**
+ * Wait for the background boot, if any, to complete. Return false if it
+ * failed or did not complete within timeout_ms (forever if negative).
+ * /pre session is locked
+ */
+static bool hruntime_join_boot(int timeout_ms) {
+	double deadline = time_now_ms() + timeout_ms;
+	while (global_boot_pending) {
+		double remaining = deadline - time_now_ms();
+		if (timeout_ms >= 0 && remaining <= 0.0) {
+			HLOG_ERROR(HLOG_SESSION, "Houdini session still not ready after %d ms", timeout_ms);
+			return false;
+		}
+		condition_wait(global_hsession_condition, global_hsession_mutex, timeout_ms >= 0 ? (int)remaining + 1 : -1);
+	}
+
+	if (NULL != global_boot_thread) {
+		// The thread no longer needs the lock, it is done or about to be
+		thread_join(global_boot_thread);
+		global_boot_thread = NULL;
+	}
+
+	if (global_boot_failed) {
+		HLOG_ERROR(HLOG_SESSION, "Houdini session failed to start in the background");
+		global_boot_failed = false; // next attempt starts it again
+		return false;
+	}
+	return true;
+}
+
+void hruntime_report_cook(HoudiniRuntime* hr) {
+	if (hr->has_cooked) {
+		return;
+	}
+	hr->has_cooked = true;
+	HLOG_INFO(HLOG_SESSION, "Time to first cook: %.1f ms (%s session)",
+		time_now_ms() - hr->init_time_ms, hr->session_was_warm ? "warm" : "new");
+}
+
+void hruntime_flush_session() {
+	hruntime_stop_linger();
+
+	hruntime_lock_session();
+	hruntime_join_boot(-1);
+	if (global_hsession_open && 0 == global_hsession_users) {
+		hruntime_close_global_session();
+	}
+	mutex_unlock(global_hsession_mutex);
+}
+
+// private
+static void hruntime_clear_inputs(HoudiniInputNode* inputs) {
+	for (int i = 0; i < MOD_HOUDINI_MAX_INPUTS; ++i) {
+		inputs[i].node_id = -1;
+		inputs[i].sop_id = -1;
 	}
+}
 
+bool hruntime_init(HoudiniRuntime* hr) {
+	HAPI_Result res;
+
+	hruntime_stop_linger();
+
+	hruntime_lock_session();
+	double wait_start = time_now_ms();
+	bool was_booting = global_boot_pending;
+	if (!hruntime_join_boot(hruntime_boot_timeout_ms())) {
+		mutex_unlock(global_hsession_mutex);
+		return false;
+	}
+	if (was_booting) {
+		HLOG_INFO(HLOG_SESSION, "Waited %.1f ms for the Houdini session to be ready", time_now_ms() - wait_start);
+	}
+	hr->session_was_warm = global_hsession_open;
+	if (!global_hsession_open) {
+		bool threaded = hruntime_default_cook_budget_ms() > 0;
+		if (!hruntime_open_session(&global_hsession, "hapi", threaded)) {
+			mutex_unlock(global_hsession_mutex);
+			return false;
+		}
+		global_hsession_open = true;
+		global_hsession_threaded = threaded;
+	}
 	global_hsession_users++;
+	hr->threaded_cooking = global_hsession_threaded;
+	mutex_unlock(global_hsession_mutex);
 
+	hr->init_time_ms = time_now_ms();
+	hr->has_cooked = false;
 	hr->hsession = global_hsession;
-	hr->current_library_path[0] = '\0';
+	hr->library = NULL;
 	hr->current_asset_index = -1;
-	hr->asset_names_array = NULL;
 	hr->asset_count = 0;
 	hr->parm_infos_array = NULL;
+	hr->parm_names_array = NULL;
 	hr->sop_array = NULL;
+	hr->part_count = 0;
+	hr->part_capacity = 0;
+	hr->part_array = NULL;
+	hr->has_parameters = false;
 	hr->parm_count = 0;
+	hr->has_identity_conditions = false;
+	hr->identity_condition_count = 0;
+	hr->identity_conditions_array = NULL;
+	hr->has_attribute_map = false;
+	hattrib_init(&hr->attribute_map);
+	hr->output_attribute_count = 0;
+	hr->output_attribute_array = NULL;
 	hr->error_message = NULL;
-	hr->input_node_id = -1;
-	hr->input_sop_id = -1;
+	hr->pool_mutex = mutex_create();
+	hruntime_clear_inputs(hr->inputs);
+	hr->asset_node_type = HAPI_NODETYPE_NONE;
+	hr->input_count = 0;
+
+	hr->pool_size = MOD_HOUDINI_DEFAULT_POOL_SIZE;
+	const char* env = getenv("MFX_HOUDINI_NODE_POOL_SIZE");
+	if (NULL != env) {
+		hr->pool_size = max(0, atoi(env));
+	}
+
+	env = getenv("MFX_HOUDINI_MERGE_PARTS");
+	hr->merge_parts = NULL != env && 0 != atoi(env);
+
+	env = getenv("MFX_HOUDINI_NORMALS");
+	hr->transfer_normals = NULL == env || 0 != atoi(env);
+
+	hr->cook_options = HAPI_CookOptions_Create();
+	hr->cook_options.packedPrimInstancingMode = HAPI_PACKEDPRIM_INSTANCING_MODE_FLAT;
+	hr->cook_budget_ms = hruntime_default_cook_budget_ms();
+	hr->cook_timed_out = false;
+	hr->is_out_of_memory = false;
+	hr->profile = NULL;
+	hr->pool_count = 0;
+	hr->pool_array = hr->pool_size > 0 ? malloc_array(sizeof(HoudiniNode), hr->pool_size, "houdini node pool") : NULL;
+	hr->pool_thread = NULL;
+	hr->pool_replenishing = false;
+	hr->pool_stopping = false;
 
 	return true;
 }
 
 void hruntime_free(HoudiniRuntime* hr) {
-	if (NULL != hr->asset_names_array) {
-		free_array(hr->asset_names_array);
+	hruntime_drain_pool(hr);
+	mutex_free(hr->pool_mutex);
+	if (NULL != hr->pool_array) {
+		free_array(hr->pool_array);
+	}
+	if (NULL != hr->library) {
+		hlibrary_release(hr->library);
 	}
 	if (NULL != hr->parm_infos_array) {
 		free_array(hr->parm_infos_array);
 	}
-	if (NULL != hr->sop_array) {
-		free_array(hr->sop_array);
+	if (NULL != hr->parm_names_array) {
+		free_array(hr->parm_names_array);
+	}
+	if (NULL != hr->part_array) {
+		free_array(hr->part_array);
+	}
+	if (NULL != hr->identity_conditions_array) {
+		free_array(hr->identity_conditions_array);
+	}
+	hattrib_free(&hr->attribute_map);
+	if (NULL != hr->output_attribute_array) {
+		free_array(hr->output_attribute_array);
 	}
 	if (NULL != hr->error_message) {
 		free_array(hr->error_message);
+		hr->error_message = NULL;
 	}
 
+	hcache_drop_owner(hr);
+
+	hruntime_lock_session();
 	global_hsession_users--;
 	if (0 == global_hsession_users) {
-		HAPI_Result res;
+		int linger_ms = hruntime_linger_duration_ms();
+		if (linger_ms > 0) {
+			global_linger_deadline = time_now_ms() + linger_ms;
+			if (NULL == global_linger_thread) {
+				global_linger_thread = thread_start(hruntime_linger_main, NULL);
+			}
+		}
+		if (0 == linger_ms || NULL == global_linger_thread) {
+			global_linger_deadline = 0.0;
+			hruntime_close_global_session();
+		}
+	}
+	mutex_unlock(global_hsession_mutex);
+	free_array(hr);
+}
+
+void hruntime_set_library(HoudiniRuntime* hr, const char* new_library_path) {
+	if (NULL != hr->library) {
+		hlibrary_release(hr->library);
+		hr->library = NULL;
+	}
+
+	hr->asset_count = 0;
 
-		printf("Releasing Houdini Session\n");
+	if (0 == strcmp(new_library_path, "")) {
+		HLOG_WARNING(HLOG_SESSION, "No Houdini library selected");
+		hr->current_asset_index = -1;
+		return;
+	}
 
-		H_CHECK_OR(HAPI_Cleanup(&hr->hsession)) {}
+	hr->library = hlibrary_acquire(&hr->hsession, new_library_path);
+	if (NULL == hr->library) {
+		ERR("Could not load Houdini library %s\n", new_library_path);
+		return;
 	}
-	free_array(hr);
+	hr->asset_count = hr->library->asset_count;
 }
 
-// private
-static void hruntime_close_library(HoudiniRuntime* hr) {
-	// TODO: Find a way to release the HAPI_AssetLibraryId
+/**
+ * With threaded cooking, node creations and cooks return before Houdini is
+ * done with them. Wait until the session is idle again and return its cook
+ * state. If it is still busy after budget_ms (when positive), the cook is
+ * interrupted and timed_out, if not NULL, is set.
+ * /pre global_cook_mutex is locked if hr->threaded_cooking
+ */
+static HAPI_State hruntime_wait_cook(HoudiniRuntime* hr, int budget_ms, bool* timed_out) {
+	HAPI_Result res;
+	int status;
+	double start_time = time_now_ms();
+	int poll_ms = MOD_HOUDINI_COOK_POLL_MIN_MS;
+	bool interrupted = false;
+
+	for (;;) {
+		res = H_CALL(HAPI_GetStatus(&hr->hsession, HAPI_STATUS_COOK_STATE, &status));
+		if (HAPI_RESULT_SUCCESS != res) {
+			ERR("Houdini error in HAPI_GetStatus: %u (%s)\n", res, HAPI_ResultMessage(res));
+			status = HAPI_STATE_LOADING; // reported as not ready
+			break;
+		}
+		if (status <= HAPI_STATE_MAX_READY_STATE || !hr->threaded_cooking) {
+			break;
+		}
+
+		if (budget_ms > 0 && !interrupted && time_now_ms() - start_time >= budget_ms) {
+			HLOG_WARNING(HLOG_COOK, "Houdini still cooking after %d ms, interrupting it", budget_ms);
+			H_CHECK_OR(HAPI_Interrupt(&hr->hsession)) {}
+			interrupted = true;
+		}
+
+		time_sleep_ms(poll_ms);
+		poll_ms = min(2 * poll_ms, MOD_HOUDINI_COOK_POLL_MAX_MS);
+	}
 
-	if (NULL != hr->asset_names_array) {
-		free_array(hr->asset_names_array);
-		hr->asset_names_array = NULL;
+	if (interrupted) {
+		HLOG_DEBUG(HLOG_COOK, "Houdini cook interrupted after %.1f ms", time_now_ms() - start_time);
+	}
+	if (NULL != timed_out) {
+		*timed_out = interrupted;
+	}
+	return (HAPI_State)status;
+}
+
+// private
+static void hruntime_lock_cook(HoudiniRuntime* hr) {
+	if (hr->threaded_cooking) {
+		mutex_lock(global_cook_mutex);
 	}
 }
 
 // private
-static bool hruntime_load_library(HoudiniRuntime* hr) {
-	// Load library
+static void hruntime_unlock_cook(HoudiniRuntime* hr) {
+	if (hr->threaded_cooking) {
+		mutex_unlock(global_cook_mutex);
+	}
+}
+
+/**
+ * Create a node without cooking it, and wait for it to exist
+ */
+static bool hruntime_instantiate(HoudiniRuntime* hr, HAPI_NodeId parent_id, const char* operator_name, const char* node_label, HAPI_NodeId* node_id) {
 	HAPI_Result res;
-	printf("Loading Houdini library %s...\n", hr->current_library_path);
+	bool ok = true;
+	hruntime_lock_cook(hr);
+	H_CHECK_OR(HAPI_CreateNode(&hr->hsession, parent_id, operator_name, node_label, false /* cook */, node_id))
+		ok = false;
+	if (ok && hr->threaded_cooking) {
+		hruntime_wait_cook(hr, -1, NULL);
+	}
+	hruntime_unlock_cook(hr);
+	return ok;
+}
 
-	H_CHECK(HAPI_LoadAssetLibraryFromFile(&hr->hsession, hr->current_library_path, true, &hr->library));
+/**
+ * Cook a node and wait for the cook to complete, interrupting it after
+ * budget_ms if positive, see hruntime_wait_cook(). Return false if the cook
+ * could not be started.
+ */
+static bool hruntime_cook_node(HoudiniRuntime* hr, HAPI_NodeId node_id, const HAPI_CookOptions* options, int budget_ms, HAPI_State* state, bool* timed_out) {
+	HAPI_Result res;
+	bool ok = true;
+	hruntime_lock_cook(hr);
+	H_CHECK_OR(HAPI_CookNode(&hr->hsession, node_id, options))
+		ok = false;
+	if (ok) {
+		HAPI_State cooking_state = hruntime_wait_cook(hr, budget_ms, timed_out);
+		if (NULL != state) {
+			*state = cooking_state;
+		}
+	}
+	hruntime_unlock_cook(hr);
+	return ok;
+}
 
-	// Update asset count
-	H_CHECK(HAPI_GetAvailableAssetCount(&hr->hsession, hr->library, &hr->asset_count));
+// private
+static void hruntime_delete_node_pair(HoudiniRuntime* hr, const HoudiniNode* node) {
+	HAPI_Result res;
 
-	hr->asset_names_array = malloc_array(sizeof(HAPI_StringHandle), hr->asset_count, "houdini asset names");
-	H_CHECK(HAPI_GetAvailableAssets(&hr->hsession, hr->library, hr->asset_names_array, hr->asset_count));
+	if (-1 != node->node_id) {
+		H_CHECK_OR(HAPI_DeleteNode(&hr->hsession, node->node_id)) {}
+	}
 
-	return true;
+	for (int i = 0; i < MOD_HOUDINI_MAX_INPUTS; ++i) {
+		if (-1 != node->inputs[i].node_id) {
+			H_CHECK_OR(HAPI_DeleteNode(&hr->hsession, node->inputs[i].node_id)) {}
+		}
+	}
 }
 
-void hruntime_set_library(HoudiniRuntime* hr, const char* new_library_path) {
-	if (0 != strcmp(hr->current_library_path, "")) {
-		hruntime_close_library(hr);
+/**
+ * Create a new asset node and, for SOP assets, the input nodes connected to
+ * it. This only writes to node so that it can run in the pool thread, except
+ * when the first node of the asset is built.
+ */
+static bool hruntime_build_node(HoudiniRuntime* hr, HoudiniNode* node) {
+	HAPI_Result res;
+
+	const char* asset_name = hlibrary_asset_name(hr->library, hr->current_asset_index);
+
+	node->node_id = -1;
+	hruntime_clear_inputs(node->inputs);
+
+	// The type of the asset is only discovered once, by creating a first node
+	if (HAPI_NODETYPE_NONE == hr->asset_node_type) {
+		if (!hruntime_instantiate(hr, -1, asset_name, NULL, &node->node_id)) {
+			return false;
+		}
+
+		HAPI_NodeInfo node_info;
+		H_CHECK_OR(HAPI_GetNodeInfo(&hr->hsession, node->node_id, &node_info)) {
+			hruntime_delete_node_pair(hr, node);
+			return false;
+		}
+		hr->asset_node_type = node_info.type;
+
+		if (HAPI_NODETYPE_SOP == node_info.type) {
+			hr->input_count = min(node_info.inputCount, MOD_HOUDINI_MAX_INPUTS);
+			if (node_info.inputCount > MOD_HOUDINI_MAX_INPUTS) {
+				HLOG_WARNING(HLOG_SESSION, "Asset has %d inputs, only the first %d are exposed", node_info.inputCount, MOD_HOUDINI_MAX_INPUTS);
+			}
+
+			H_CHECK_OR(HAPI_DeleteNode(&hr->hsession, node->node_id)) {}
+			node->node_id = -1;
+		}
 	}
 
-	strcpy(hr->current_library_path, new_library_path);
+	// If node is a SOP, create context OBJ and input nodes
+	if (HAPI_NODETYPE_SOP == hr->asset_node_type) {
+		if (!hruntime_instantiate(hr, -1, asset_name, NULL, &node->node_id)) {
+			return false;
+		}
 
-	if (0 == strcmp(hr->current_library_path, "")) {
-		printf("No Houdini library selected\n");
-		hr->asset_count = 0;
-		hr->current_asset_index = -1;
+		for (int i = 0; i < hr->input_count; ++i) {
+			HoudiniInputNode* input = &node->inputs[i];
+			H_CHECK_OR(HAPI_CreateInputNode(&hr->hsession, &input->node_id, NULL)) {
+				hruntime_delete_node_pair(hr, node);
+				return false;
+			}
+
+			HAPI_GeoInfo geo_info;
+			H_CHECK_OR(HAPI_GetDisplayGeoInfo(&hr->hsession, input->node_id, &geo_info)) {
+				hruntime_delete_node_pair(hr, node);
+				return false;
+			}
+			input->sop_id = geo_info.nodeId;
+
+			H_CHECK_OR(HAPI_ConnectNodeInput(&hr->hsession, node->node_id, i, input->sop_id, 0)) {
+				hruntime_delete_node_pair(hr, node);
+				return false;
+			}
+		}
 	}
-	else {
-		hruntime_load_library(hr);
+	else if (-1 == node->node_id) {
+		return hruntime_instantiate(hr, -1, asset_name, NULL, &node->node_id);
 	}
+
+	return true;
 }
 
 /**
- * /pre hruntime_set_library_path has been called
+ * Revert the parameters of a node that the host may have changed, i.e. the
+ * mfx_ ones, to their defaults, which restores their expressions if any.
  */
-void hruntime_create_node(HoudiniRuntime* hr) {
+static bool hruntime_reset_node(HoudiniRuntime* hr, const HoudiniNode* node) {
 	HAPI_Result res;
 
-	char asset_name[MOD_HOUDINI_MAX_ASSET_NAME];
-	H_CHECK_OR(HAPI_GetString(&hr->hsession, hr->asset_names_array[hr->current_asset_index], asset_name, MOD_HOUDINI_MAX_ASSET_NAME))
-		return;
+	if (!hr->has_parameters) {
+		return false;
+	}
 
-	H_CHECK_OR(HAPI_CreateNode(&hr->hsession, -1, asset_name, NULL, false /* cook */, &hr->node_id))
-		return;
+	for (int i = 0; i < hr->parm_count; ++i) {
+		const char* name = hr->parm_names_array + MOD_HOUDINI_MAX_PARAMETER_NAME * i;
+		if (0 == strncmp(name, "mfx_", 4)) {
+			H_CHECK(HAPI_RevertParmToDefaults(&hr->hsession, node->node_id, name));
+		}
+	}
+	return true;
+}
 
-	HAPI_NodeInfo node_info;
-	H_CHECK_OR(HAPI_GetNodeInfo(&hr->hsession, hr->node_id, &node_info))
+static void hruntime_pool_thread_main(void* arg) {
+	HoudiniRuntime* hr = (HoudiniRuntime*)arg;
+
+	mutex_lock(hr->pool_mutex);
+	while (hr->pool_count < hr->pool_size && !hr->pool_stopping) {
+		mutex_unlock(hr->pool_mutex);
+
+		// HAPI serializes calls made on the same session, so this only
+		// competes with the host thread when it is itself talking to Houdini.
+		HoudiniNode node;
+		bool ok = hruntime_build_node(hr, &node);
+
+		mutex_lock(hr->pool_mutex);
+		if (!ok) {
+			break;
+		}
+		if (hr->pool_count < hr->pool_size && !hr->pool_stopping) {
+			hr->pool_array[hr->pool_count++] = node;
+		}
+		else {
+			mutex_unlock(hr->pool_mutex);
+			hruntime_delete_node_pair(hr, &node);
+			mutex_lock(hr->pool_mutex);
+		}
+	}
+	hr->pool_replenishing = false;
+	mutex_unlock(hr->pool_mutex);
+}
+
+// private
+static void hruntime_join_pool_thread(HoudiniRuntime* hr) {
+	if (NULL != hr->pool_thread) {
+		thread_join(hr->pool_thread);
+		hr->pool_thread = NULL;
+	}
+}
+
+void hruntime_warm_pool(HoudiniRuntime* hr) {
+	if (0 == hr->pool_size || NULL == hr->library || -1 == hr->current_asset_index) {
 		return;
-	
-	hr->input_node_id = -1;
-	hr->input_sop_id = -1;
+	}
 
-	// If node is a SOP, create context OBJ and input node
-	if (HAPI_NODETYPE_SOP == node_info.type) {
-		H_CHECK_OR(HAPI_DeleteNode(&hr->hsession, hr->node_id))
-			return;
+	mutex_lock(hr->pool_mutex);
+	bool must_start = !hr->pool_replenishing && hr->pool_count < hr->pool_size;
+	if (must_start) {
+		hr->pool_replenishing = true;
+	}
+	mutex_unlock(hr->pool_mutex);
+
+	if (must_start) {
+		// Previous thread is done since pool_replenishing was false
+		hruntime_join_pool_thread(hr);
+		hr->pool_thread = thread_start(hruntime_pool_thread_main, hr);
+		if (NULL == hr->pool_thread) {
+			mutex_lock(hr->pool_mutex);
+			hr->pool_replenishing = false;
+			mutex_unlock(hr->pool_mutex);
+		}
+	}
+}
 
-		H_CHECK_OR(HAPI_CreateInputNode(&hr->hsession, &hr->input_node_id, NULL))
-			return;
-		
-		HAPI_GeoInfo geo_info;
-		H_CHECK_OR(HAPI_GetDisplayGeoInfo(&hr->hsession, hr->input_node_id, &geo_info))
-			return;
-		hr->input_sop_id = geo_info.nodeId;
+// private
+static void hruntime_drain_pool(HoudiniRuntime* hr) {
+	mutex_lock(hr->pool_mutex);
+	hr->pool_stopping = true;
+	mutex_unlock(hr->pool_mutex);
 
-		//res = HAPI_CreateNode(&hr->hsession, hr->input_node_id, asset_name, NULL, false /* cook */, &hr->node_id);
-		H_CHECK_OR(HAPI_CreateNode(&hr->hsession, -1, asset_name, NULL, false /* cook */, &hr->node_id))
-			return;
-		
-		H_CHECK_OR(HAPI_ConnectNodeInput(&hr->hsession, hr->node_id, 0, hr->input_sop_id, 0))
+	hruntime_join_pool_thread(hr);
+
+	for (int i = 0; i < hr->pool_count; ++i) {
+		hruntime_delete_node_pair(hr, &hr->pool_array[i]);
+	}
+	hr->pool_count = 0;
+	hr->pool_stopping = false;
+}
+
+/**
+ * /pre hruntime_set_library_path has been called
+ */
+void hruntime_create_node(HoudiniRuntime* hr) {
+	HoudiniNode node;
+	bool from_pool = false;
+
+	mutex_lock(hr->pool_mutex);
+	if (hr->pool_count > 0) {
+		node = hr->pool_array[--hr->pool_count];
+		from_pool = true;
+	}
+	mutex_unlock(hr->pool_mutex);
+
+	if (!from_pool) {
+		if (!hruntime_build_node(hr, &node)) {
+			hr->node_id = -1;
+			hruntime_clear_inputs(hr->inputs);
 			return;
+		}
 	}
+
+	hr->node_id = node.node_id;
+	memcpy(hr->inputs, node.inputs, sizeof(hr->inputs));
 }
 
 void hruntime_destroy_node(HoudiniRuntime* hr) {
-	HAPI_Result res;
+	HoudiniNode node;
+	node.node_id = hr->node_id;
+	memcpy(node.inputs, hr->inputs, sizeof(node.inputs));
 
-	H_CHECK_OR(HAPI_DeleteNode(&hr->hsession, hr->node_id))
+	if (-1 == node.node_id) {
 		return;
-	
-	if (-1 != hr->input_node_id) {
-		H_CHECK_OR(HAPI_DeleteNode(&hr->hsession, hr->node_id))
+	}
+
+	// Give the node back to the pool if there is room for it
+	mutex_lock(hr->pool_mutex);
+	bool has_room = hr->pool_count < hr->pool_size && !hr->pool_stopping;
+	mutex_unlock(hr->pool_mutex);
+
+	if (has_room && hruntime_reset_node(hr, &node)) {
+		mutex_lock(hr->pool_mutex);
+		has_room = hr->pool_count < hr->pool_size;
+		if (has_room) {
+			hr->pool_array[hr->pool_count++] = node;
+		}
+		mutex_unlock(hr->pool_mutex);
+		if (has_room) {
 			return;
+		}
 	}
+
+	hruntime_delete_node_pair(hr, &node);
 }
 
 /**
@@ -254,212 +829,1567 @@ void hruntime_destroy_node(HoudiniRuntime* hr) {
 void hruntime_fetch_parameters(HoudiniRuntime* hr) {
 	HAPI_Result res;
 
+	hr->has_parameters = false;
+	hr->parm_count = 0;
 	if (NULL != hr->parm_infos_array) {
 		free_array(hr->parm_infos_array);
 		hr->parm_infos_array = NULL;
-		hr->parm_count = 0;
+	}
+	if (NULL != hr->parm_names_array) {
+		free_array(hr->parm_names_array);
+		hr->parm_names_array = NULL;
 	}
 
 	HAPI_NodeInfo node_info;
 	H_CHECK_OR(HAPI_GetNodeInfo(&hr->hsession, hr->node_id, &node_info))
 		return;
 
-	hr->parm_count = node_info.parmCount;
+	if (0 == node_info.parmCount) {
+		hr->has_parameters = true;
+		return;
+	}
 
-	if (0 != node_info.parmCount) {
-		hr->parm_infos_array = malloc_array(sizeof(HAPI_ParmInfo), node_info.parmCount, "houdini parameter info");
+	HAPI_ParmInfo* parm_infos_array = malloc_array(sizeof(HAPI_ParmInfo), node_info.parmCount, "houdini parameter info");
+	H_CHECK_OR(HAPI_GetParameters(&hr->hsession, hr->node_id, parm_infos_array, 0, node_info.parmCount))
+	{
+		free_array(parm_infos_array);
+		return;
+	}
 
-		H_CHECK_OR(HAPI_GetParameters(&hr->hsession, hr->node_id, hr->parm_infos_array, 0, node_info.parmCount))
-			return;
+	// Names are resolved once for all so that looking them up does not
+	// require a round trip to Houdini
+	char* parm_names_array = malloc_array(MOD_HOUDINI_MAX_PARAMETER_NAME, node_info.parmCount, "houdini parameter names");
+	for (int i = 0; i < node_info.parmCount; ++i) {
+		char* name = parm_names_array + MOD_HOUDINI_MAX_PARAMETER_NAME * i;
+		H_CHECK_OR(HAPI_GetString(&hr->hsession, parm_infos_array[i].nameSH, name, MOD_HOUDINI_MAX_PARAMETER_NAME)) {
+			name[0] = '\0';
+		}
 	}
+
+	// Only expose the parameters once both arrays are complete
+	hr->parm_infos_array = parm_infos_array;
+	hr->parm_names_array = parm_names_array;
+	hr->parm_count = node_info.parmCount;
+	hr->has_parameters = true;
 }
 
 /**
  * /pre hruntime_fetch_parameters has been called
  */
 void hruntime_get_parameter_name(HoudiniRuntime* hr, int parm_index, char* name) {
-	HAPI_Result res;
-	H_CHECK_OR(HAPI_GetString(&hr->hsession, hr->parm_infos_array[parm_index].nameSH, name, MOD_HOUDINI_MAX_PARAMETER_NAME)) {}
+	strncpy(name, hr->parm_names_array + MOD_HOUDINI_MAX_PARAMETER_NAME * parm_index, MOD_HOUDINI_MAX_PARAMETER_NAME - 1);
+	name[MOD_HOUDINI_MAX_PARAMETER_NAME - 1] = '\0';
 }
 
-void hruntime_set_float_parm(HoudiniRuntime* hr, int parm_index, const float* values, int length) {
-	HAPI_Result res;
-	H_CHECK_OR(HAPI_SetParmFloatValues(&hr->hsession, hr->node_id, values, hr->parm_infos_array[parm_index].floatValuesIndex, length)) {}
+int hruntime_find_parameter(HoudiniRuntime* hr, const char* name) {
+	for (int i = 0; i < hr->parm_count; ++i) {
+		if (0 == strcmp(hr->parm_names_array + MOD_HOUDINI_MAX_PARAMETER_NAME * i, name)) {
+			return i;
+		}
+	}
+	return -1;
 }
 
-void hruntime_set_int_parm(HoudiniRuntime* hr, int parm_index, const int* values, int length) {
+void hruntime_bind_instance(HoudiniRuntime* hr, const HoudiniInstance* instance) {
+	hr->node_id = instance->node_id;
+	memcpy(hr->inputs, instance->inputs, sizeof(hr->inputs));
+	hr->sop_array = instance->sop_array;
+	hr->sop_count = instance->sop_count;
+}
+
+HoudiniInstance* hruntime_new_instance(HoudiniRuntime* hr) {
+	HoudiniInstance* instance = malloc_array(sizeof(HoudiniInstance), 1, "houdini instance");
+	instance->node_id = hr->node_id;
+	memcpy(instance->inputs, hr->inputs, sizeof(instance->inputs));
+	for (int i = 0; i < MOD_HOUDINI_MAX_INPUTS; ++i) {
+		instance->input_fingerprints[i] = HRUNTIME_FINGERPRINT_UNKNOWN;
+	}
+	instance->sop_count = 0;
+	instance->sop_capacity = 0;
+	instance->sop_array = NULL;
+	instance->sop_child_count = -1;
+	instance->sop_unique_id = -1;
+	instance->sop_check_count = 0;
+	instance->sops_changed = true;
+	instance->topology_check_count = 0;
+	instance->merge_geo_id = -1;
+	instance->merge_input_id = -1;
+	instance->merge_output_id = -1;
+	instance->is_stale = false;
+	instance->cook_count = 0;
+	instance->unique_id = interlocked_increment(&global_instance_count);
+	instance->is_changing = false;
+	instance->dirty_parms_array = NULL;
+	if (hr->parm_count > 0) {
+		instance->dirty_parms_array = malloc_array(sizeof(bool), hr->parm_count, "houdini dirty parameters");
+		memset(instance->dirty_parms_array, 0, sizeof(bool) * hr->parm_count);
+	}
+	return instance;
+}
+
+void hruntime_free_instance(HoudiniRuntime* hr, HoudiniInstance* instance) {
+	hcache_drop_owner(instance);
+	hruntime_delete_merge_network(hr, instance);
+	if (NULL != instance->dirty_parms_array) {
+		free_array(instance->dirty_parms_array);
+	}
+	if (NULL != instance->sop_array) {
+		free_array(instance->sop_array);
+	}
+	if (hr->sop_array == instance->sop_array) {
+		hr->sop_array = NULL;
+		hr->sop_count = 0;
+	}
+	free_array(instance);
+}
+
+static int* snapshot_int_values(HoudiniParmSnapshot* snapshot) {
+	return (int*)(snapshot + 1);
+}
+
+static float* snapshot_float_values(HoudiniParmSnapshot* snapshot) {
+	return (float*)(snapshot_int_values(snapshot) + snapshot->int_count);
+}
+
+static unsigned char* snapshot_int_flags(HoudiniParmSnapshot* snapshot) {
+	return (unsigned char*)(snapshot_float_values(snapshot) + snapshot->float_count);
+}
+
+static unsigned char* snapshot_float_flags(HoudiniParmSnapshot* snapshot) {
+	return snapshot_int_flags(snapshot) + snapshot->int_count;
+}
+
+HoudiniParmSnapshot* hruntime_acquire_parm_snapshot(HoudiniRuntime* hr, const HoudiniInstance* instance) {
+	HAPI_Result res;
+	HoudiniParmSnapshot* snapshot = hcache_get(instance, HCACHE_PARM_SNAPSHOT, NULL);
+	if (NULL != snapshot) {
+		return snapshot;
+	}
+
+	HAPI_NodeInfo node_info;
+	H_CHECK_OR(HAPI_GetNodeInfo(&hr->hsession, instance->node_id, &node_info))
+		return NULL;
+
+	size_t size =
+		sizeof(HoudiniParmSnapshot)
+		+ sizeof(int) * node_info.parmIntValueCount
+		+ sizeof(float) * node_info.parmFloatValueCount
+		+ (size_t)node_info.parmIntValueCount + (size_t)node_info.parmFloatValueCount;
+	snapshot = hcache_put(instance, HCACHE_PARM_SNAPSHOT, size);
+	if (NULL == snapshot) {
+		return NULL;
+	}
+
+	snapshot->int_count = node_info.parmIntValueCount;
+	snapshot->float_count = node_info.parmFloatValueCount;
+	snapshot->dirty_int_min = snapshot->dirty_float_min = INT_MAX;
+	snapshot->dirty_int_max = snapshot->dirty_float_max = -1;
+	memset(snapshot_int_flags(snapshot), 0, (size_t)snapshot->int_count + (size_t)snapshot->float_count);
+
+	bool ok = true;
+	if (snapshot->int_count > 0) {
+		HSTATS_BYTES(0, sizeof(int) * snapshot->int_count);
+		H_CHECK_OR(HAPI_GetParmIntValues(&hr->hsession, instance->node_id, snapshot_int_values(snapshot), 0, snapshot->int_count))
+			ok = false;
+	}
+	if (ok && snapshot->float_count > 0) {
+		HSTATS_BYTES(0, sizeof(float) * snapshot->float_count);
+		H_CHECK_OR(HAPI_GetParmFloatValues(&hr->hsession, instance->node_id, snapshot_float_values(snapshot), 0, snapshot->float_count))
+			ok = false;
+	}
+	if (!ok) {
+		hcache_drop(instance, HCACHE_PARM_SNAPSHOT);
+		return NULL;
+	}
+	return snapshot;
+}
+
+void hruntime_stage_float_parm(HoudiniRuntime* hr, HoudiniParmSnapshot* snapshot, int parm_index, const float* values, int length) {
+	int start = hr->parm_infos_array[parm_index].floatValuesIndex;
+	float* dst = snapshot_float_values(snapshot) + start;
+	if (start + length > snapshot->float_count) {
+		return;
+	}
+	for (int k = 0; k < length; ++k) {
+		if (dst[k] != values[k]) {
+			dst[k] = values[k];
+			snapshot_float_flags(snapshot)[start + k] = 1;
+			snapshot->dirty_float_min = min(snapshot->dirty_float_min, start + k);
+			snapshot->dirty_float_max = max(snapshot->dirty_float_max, start + k);
+		}
+	}
+}
+
+void hruntime_stage_int_parm(HoudiniRuntime* hr, HoudiniParmSnapshot* snapshot, int parm_index, const int* values, int length) {
+	int start = hr->parm_infos_array[parm_index].intValuesIndex;
+	int* dst = snapshot_int_values(snapshot) + start;
+	if (start + length > snapshot->int_count) {
+		return;
+	}
+	for (int k = 0; k < length; ++k) {
+		if (dst[k] != values[k]) {
+			dst[k] = values[k];
+			snapshot_int_flags(snapshot)[start + k] = 1;
+			snapshot->dirty_int_min = min(snapshot->dirty_int_min, start + k);
+			snapshot->dirty_int_max = max(snapshot->dirty_int_max, start + k);
+		}
+	}
+}
+
+/**
+ * Find the next run of consecutive dirty flags in [*start, max] and clear
+ * them. Return the length of the run, 0 if there is none left.
+ */
+static int snapshot_next_dirty_run(unsigned char* flags, int* start, int max) {
+	int first = *start;
+	while (first <= max && 0 == flags[first]) {
+		++first;
+	}
+	int end = first;
+	while (end <= max && 0 != flags[end]) {
+		flags[end++] = 0;
+	}
+	*start = first;
+	return end - first;
+}
+
+void hruntime_commit_parm_snapshot(HoudiniRuntime* hr, const HoudiniInstance* instance, HoudiniParmSnapshot* snapshot) {
+	HAPI_Result res;
+	bool ok = true;
+
+	// Values in between dirty ones are not sent again: they may not be
+	// exposed to the host, or be driven by expressions in the asset.
+	int start = snapshot->dirty_int_min;
+	for (int length; 0 != (length = snapshot_next_dirty_run(snapshot_int_flags(snapshot), &start, snapshot->dirty_int_max)); start += length) {
+		HSTATS_BYTES(sizeof(int) * length, 0);
+		H_CHECK_OR(HAPI_SetParmIntValues(&hr->hsession, instance->node_id, snapshot_int_values(snapshot) + start, start, length))
+			ok = false;
+	}
+	start = snapshot->dirty_float_min;
+	for (int length; 0 != (length = snapshot_next_dirty_run(snapshot_float_flags(snapshot), &start, snapshot->dirty_float_max)); start += length) {
+		HSTATS_BYTES(sizeof(float) * length, 0);
+		H_CHECK_OR(HAPI_SetParmFloatValues(&hr->hsession, instance->node_id, snapshot_float_values(snapshot) + start, start, length))
+			ok = false;
+	}
+
+	snapshot->dirty_int_min = snapshot->dirty_float_min = INT_MAX;
+	snapshot->dirty_int_max = snapshot->dirty_float_max = -1;
+	hcache_release(instance, HCACHE_PARM_SNAPSHOT);
+
+	if (!ok) {
+		// The snapshot no longer mirrors the node
+		hcache_drop(instance, HCACHE_PARM_SNAPSHOT);
+	}
+}
+
+/**
+ * Parse a list of numbers separated by spaces or commas into values. Missing
+ * components are set to 0. Numbers are read in single precision, like
+ * Houdini float parameters.
+ */
+static void parse_identity_values(const char* str, double values[4], int size) {
+	char* end;
+	for (int k = 0; k < size; ++k) {
+		while (*str == ' ' || *str == ',') ++str;
+		values[k] = (double)strtof(str, &end);
+		str = end;
+	}
+}
+
+void hruntime_fetch_identity_conditions(HoudiniRuntime* hr) {
+	HAPI_Result res;
+
+	if (NULL != hr->identity_conditions_array) {
+		free_array(hr->identity_conditions_array);
+		hr->identity_conditions_array = NULL;
+	}
+	hr->identity_condition_count = 0;
+	hr->has_identity_conditions = true;
+
+	if (0 == hr->parm_count) {
+		return;
+	}
+
+	hr->identity_conditions_array = malloc_array(sizeof(HoudiniIdentityCondition), hr->parm_count, "houdini identity conditions");
+
+	char name[MOD_HOUDINI_MAX_PARAMETER_NAME];
+	char tag_value[MOD_HOUDINI_MAX_PARAMETER_NAME];
+	for (int i = 0; i < hr->parm_count; ++i) {
+		const HAPI_ParmInfo* info = &hr->parm_infos_array[i];
+		if (info->size > 4 || NULL == houdini_to_ofx_type(info->type, info->size)) {
+			continue;
+		}
+
+		hruntime_get_parameter_name(hr, i, name);
+		if (0 != strncmp(name, "mfx_", 4)) {
+			continue;
+		}
+
+		HoudiniIdentityCondition* cond = &hr->identity_conditions_array[hr->identity_condition_count];
+		HAPI_Bool has_tag = false;
+		H_CHECK_OR(HAPI_ParmHasTag(&hr->hsession, hr->node_id, info->id, MOD_HOUDINI_IDENTITY_TAG, &has_tag))
+			continue;
+
+		if (has_tag) {
+			HAPI_StringHandle tag_sh;
+			H_CHECK_OR(HAPI_GetParmTagValue(&hr->hsession, hr->node_id, info->id, MOD_HOUDINI_IDENTITY_TAG, &tag_sh))
+				continue;
+			H_CHECK_OR(HAPI_GetString(&hr->hsession, tag_sh, tag_value, MOD_HOUDINI_MAX_PARAMETER_NAME))
+				continue;
+			parse_identity_values(tag_value, cond->values, info->size);
+		}
+		else if (0 == strcmp(name, MOD_HOUDINI_ENABLE_PARM) && 1 == info->size
+			&& (HAPI_PARMTYPE_TOGGLE == info->type || HAPI_PARMTYPE_INT == info->type)) {
+			cond->values[0] = 0.0;
+		}
+		else {
+			continue;
+		}
+
+		strncpy(cond->parm_name, name, MOD_HOUDINI_MAX_PARAMETER_NAME);
+		cond->type = info->type;
+		cond->size = info->size;
+		HLOG_DEBUG(HLOG_PARM, "Parameter %s declares an identity condition", name);
+		++hr->identity_condition_count;
+	}
+}
+
+// private
+static char* hruntime_get_string_parm_value(HoudiniRuntime* hr, const char* parm_name) {
+	HAPI_Result res;
+	HAPI_StringHandle value_sh;
+	int length;
+	H_CHECK_OR(HAPI_GetParmStringValue(&hr->hsession, hr->node_id, parm_name, 0, true, &value_sh))
+		return NULL;
+	H_CHECK_OR(HAPI_GetStringBufLength(&hr->hsession, value_sh, &length))
+		return NULL;
+
+	char* value = malloc_array(sizeof(char), length + 1, "houdini string parameter");
+	H_CHECK_OR(HAPI_GetString(&hr->hsession, value_sh, value, length + 1))
+	{
+		free_array(value);
+		return NULL;
+	}
+	return value;
+}
+
+void hruntime_fetch_attribute_map(HoudiniRuntime* hr) {
+	hattrib_free(&hr->attribute_map);
+	hr->has_attribute_map = true;
+
+	char* spec = NULL;
+	int parm_index = hruntime_find_parameter(hr, MOD_HOUDINI_ATTRIBUTE_MAP_PARM);
+	if (-1 != parm_index && HAPI_PARMTYPE_STRING == hr->parm_infos_array[parm_index].type) {
+		spec = hruntime_get_string_parm_value(hr, MOD_HOUDINI_ATTRIBUTE_MAP_PARM);
+	}
+
+	if (NULL != spec) {
+		HLOG_DEBUG(HLOG_GEO, "Asset declares its attribute map: %s", spec);
+		hattrib_parse(&hr->attribute_map, spec);
+		free_array(spec);
+	} else {
+		hattrib_parse(&hr->attribute_map, HATTRIB_DEFAULT_MAP);
+		if (hr->transfer_normals) {
+			hattrib_parse(&hr->attribute_map, HATTRIB_NORMAL_MAP);
+		}
+	}
+
+	if (NULL != hr->output_attribute_array) {
+		free_array(hr->output_attribute_array);
+		hr->output_attribute_array = NULL;
+	}
+	hr->output_attribute_count = 0;
+	if (hr->attribute_map.count > 0) {
+		hr->output_attribute_array = malloc_array(sizeof(HoudiniOutputAttribute), hr->attribute_map.count, "houdini output attributes");
+	}
+}
+
+void hruntime_fetch_cook_budget(HoudiniRuntime* hr) {
 	HAPI_Result res;
+	hr->cook_budget_ms = hruntime_default_cook_budget_ms();
+
+	int parm_index = hruntime_find_parameter(hr, MOD_HOUDINI_COOK_BUDGET_PARM);
+	if (-1 == parm_index || HAPI_PARMTYPE_FLOAT != hr->parm_infos_array[parm_index].type) {
+		return;
+	}
+
+	float budget;
+	H_CHECK_OR(HAPI_GetParmFloatValue(&hr->hsession, hr->node_id, MOD_HOUDINI_COOK_BUDGET_PARM, 0, &budget))
+		return;
+	hr->cook_budget_ms = max(0, (int)(1000.0f * budget));
+	HLOG_DEBUG(HLOG_COOK, "Asset declares a cook budget of %d ms", hr->cook_budget_ms);
+	if (hr->cook_budget_ms > 0 && !hr->threaded_cooking) {
+		HLOG_WARNING(HLOG_COOK, "The cook budget of the asset is ignored because MFX_HOUDINI_COOK_BUDGET is not set");
+	}
+}
+
+void hruntime_set_float_parm(HoudiniRuntime* hr, int parm_index, const float* values, int length) {
+	HAPI_Result res;
+	HSTATS_BYTES(sizeof(float) * length, 0);
+	H_CHECK_OR(HAPI_SetParmFloatValues(&hr->hsession, hr->node_id, values, hr->parm_infos_array[parm_index].floatValuesIndex, length)) {}
+}
+
+void hruntime_set_int_parm(HoudiniRuntime* hr, int parm_index, const int* values, int length) {
+	HAPI_Result res;
+	HSTATS_BYTES(sizeof(int) * length, 0);
 	H_CHECK_OR(HAPI_SetParmIntValues(&hr->hsession, hr->node_id, values, hr->parm_infos_array[parm_index].intValuesIndex, length)) {}
 }
 
-bool hruntime_cook_asset(HoudiniRuntime* hr) {
+// private
+static int hruntime_start_profile(HoudiniRuntime* hr) {
 	HAPI_Result res;
-	int status;
+	int profile_id = -1;
+	if (NULL == hr->profile) {
+		return -1;
+	}
+	H_CHECK_OR(HAPI_StartPerformanceMonitorProfile(&hr->hsession, hr->profile->base_path, &profile_id)) {
+		return -1;
+	}
+	return profile_id;
+}
+
+// private
+static void hruntime_stop_profile(HoudiniRuntime* hr, int profile_id) {
+	HAPI_Result res;
+	char path[HPROFILE_MAX_PATH + 8];
+	if (-1 == profile_id) {
+		return;
+	}
+	hprofile_path(hr->profile, "hperf", path, sizeof(path));
+	H_CHECK_OR(HAPI_StopPerformanceMonitorProfile(&hr->hsession, profile_id, path)) {
+		return;
+	}
+	HLOG_INFO(HLOG_COOK, "Houdini performance profile written to %s", path);
+}
+
+bool hruntime_cook_asset(HoudiniRuntime* hr) {
 	HAPI_State cooking_state;
 
-	printf("Houdini: cooking root node...\n");
-	H_CHECK(HAPI_CookNode(&hr->hsession, hr->node_id, NULL));
+	hr->cook_timed_out = false;
 
-	res = HAPI_GetStatus(&hr->hsession, HAPI_STATUS_COOK_STATE, &status);
-	cooking_state = (HAPI_State)status;
-	if (HAPI_RESULT_SUCCESS != res) {
-		ERR("Houdini error in HAPI_GetStatus: %u (%s)\n", res, HAPI_ResultMessage(res));
-		cooking_state = HAPI_STATE_LOADING;
+	HLOG_DEBUG(HLOG_COOK, "Cooking root node...");
+	int profile_id = hruntime_start_profile(hr);
+	bool cooked = hruntime_cook_node(hr, hr->node_id, &hr->cook_options, hr->cook_budget_ms, &cooking_state, &hr->cook_timed_out);
+	hruntime_stop_profile(hr, profile_id);
+	if (!cooked) {
+		return false;
+	}
+	if (hr->cook_timed_out) {
+		HLOG_WARNING(HLOG_COOK, "Cook exceeded its budget of %d ms and was interrupted.", hr->cook_budget_ms);
+		return false;
 	}
 
-	printf("Houdini cooking state: %u\n", cooking_state);
+	HLOG_DEBUG(HLOG_COOK, "Houdini cooking state: %u", cooking_state);
 	bool is_ready = cooking_state <= HAPI_STATE_MAX_READY_STATE;
 
 	if (is_ready) {
 		if (cooking_state == HAPI_STATE_READY_WITH_FATAL_ERRORS) {
-			printf("Warning: Houdini Cooking terminated with fatal errors.\n");
+			HLOG_WARNING(HLOG_COOK, "Houdini Cooking terminated with fatal errors.");
 		}
 		else if (cooking_state == HAPI_STATE_READY_WITH_COOK_ERRORS) {
-			printf("Warning: Houdini Cooking terminated with cook errors.\n");
+			HLOG_WARNING(HLOG_COOK, "Houdini Cooking terminated with cook errors.");
 		}
 	}
 
 	if (!is_ready) {
-		printf("Cooking not finished, skipping Houdini modifier.\n");
+		HLOG_WARNING(HLOG_COOK, "Cooking not finished, skipping Houdini modifier.");
 		return false;
 	}
 
 	return true;
 }
 
-bool hruntime_fetch_sops(HoudiniRuntime* hr) {
+// private
+static unsigned int hash_node_ids(const HAPI_NodeId* ids, int count) {
+	unsigned int hash = 2166136261u;
+	for (int i = 0; i < count; ++i) {
+		hash = (hash ^ (unsigned int)ids[i]) * 16777619u;
+	}
+	return hash;
+}
+
+// private
+static void hruntime_reserve_sops(HoudiniInstance* instance, int count) {
+	if (count <= instance->sop_capacity) {
+		return;
+	}
+	if (NULL != instance->sop_array) {
+		free_array(instance->sop_array);
+	}
+	instance->sop_capacity = max(count, 2 * instance->sop_capacity);
+	instance->sop_array = malloc_array(sizeof(HAPI_NodeId), instance->sop_capacity, "houdini cooked SOPs");
+}
+
+// private
+static bool hruntime_list_sops(HoudiniRuntime* hr, HoudiniInstance* instance) {
 	HAPI_Result res;
 	HAPI_NodeInfo node_info;
 
 	H_CHECK(HAPI_GetNodeInfo(&hr->hsession, hr->node_id, &node_info));
 
-	printf("Node type: %d\n", node_info.type);
-
-	if (NULL != hr->sop_array) {
-		free_array(hr->sop_array);
-		hr->sop_array = NULL;
+	// Cheap revalidation of the previous list
+	if (node_info.childNodeCount == instance->sop_child_count
+		&& node_info.uniqueHoudiniNodeId == instance->sop_unique_id
+		&& ++instance->sop_check_count < MOD_HOUDINI_SOP_RECOMPOSE_PERIOD) {
+		hr->sop_array = instance->sop_array;
+		hr->sop_count = instance->sop_count;
+		return true;
 	}
 
+	// Remember the previous list to tell whether it changed
+	int previous_sop_count = instance->sop_count;
+	unsigned int previous_sop_hash = hash_node_ids(instance->sop_array, instance->sop_count);
+
+	instance->sop_child_count = -1;
+	instance->sop_check_count = 0;
+	instance->sop_count = 0;
+	instance->sops_changed = true;
+	hr->sop_count = 0;
+
 	switch (node_info.type) {
 	case HAPI_NODETYPE_SOP:
 	{
-		hr->sop_count = 1;
-		hr->sop_array = malloc_array(sizeof(HAPI_NodeId), hr->sop_count, "houdini cooked SOPs");
-		hr->sop_array[0] = hr->node_id;
+		hruntime_reserve_sops(instance, 1);
+		instance->sop_count = 1;
+		instance->sop_array[0] = hr->node_id;
+		break;
+	}
+
+	case HAPI_NODETYPE_OBJ:
+	{
+		int sop_count;
+		H_CHECK(HAPI_ComposeChildNodeList(&hr->hsession, hr->node_id, HAPI_NODETYPE_SOP, HAPI_NODEFLAGS_DISPLAY, true, &sop_count));
+
+		hruntime_reserve_sops(instance, max(1, sop_count));
+
+		H_CHECK(HAPI_GetComposedChildNodeList(&hr->hsession, hr->node_id, instance->sop_array, sop_count));
+		instance->sop_count = sop_count;
+
+		HLOG_DEBUG(HLOG_GEO, "Asset has %d Display SOP(s).", sop_count);
+		break;
+	}
+
+	default:
+		HLOG_WARNING(HLOG_GEO, "Houdini modifier only supports SOP and OBJ digital asset, but this asset has type %d.", node_info.type);
+		return false;
+	}
+
+	instance->sop_child_count = node_info.childNodeCount;
+	instance->sop_unique_id = node_info.uniqueHoudiniNodeId;
+	instance->sops_changed =
+		previous_sop_count != instance->sop_count
+		|| previous_sop_hash != hash_node_ids(instance->sop_array, instance->sop_count);
+	hr->sop_array = instance->sop_array;
+	hr->sop_count = instance->sop_count;
+	return true;
+}
+
+// private
+static void hruntime_delete_merge_network(HoudiniRuntime* hr, HoudiniInstance* instance) {
+	HAPI_Result res;
+	if (-1 != instance->merge_geo_id) {
+		H_CHECK_OR(HAPI_DeleteNode(&hr->hsession, instance->merge_geo_id)) {}
+	}
+	instance->merge_geo_id = -1;
+	instance->merge_input_id = -1;
+	instance->merge_output_id = -1;
+}
+
+// private
+static bool hruntime_update_merge_network(HoudiniRuntime* hr, HoudiniInstance* instance) {
+	HAPI_Result res;
+
+	if (-1 == instance->merge_geo_id) {
+		if (!hruntime_instantiate(hr, -1, "Object/geo", "mfx_merge", &instance->merge_geo_id)
+			|| !hruntime_instantiate(hr, instance->merge_geo_id, "object_merge", NULL, &instance->merge_input_id)
+			|| !hruntime_instantiate(hr, instance->merge_geo_id, "unpack", NULL, &instance->merge_output_id)) {
+			return false;
+		}
+		H_CHECK(HAPI_ConnectNodeInput(&hr->hsession, instance->merge_output_id, 0, instance->merge_input_id, 0));
+	}
+
+	H_CHECK(HAPI_SetParmIntValue(&hr->hsession, instance->merge_input_id, "numobj", 0, instance->sop_count));
+
+	for (int sid = 0; sid < instance->sop_count; ++sid) {
+		char path[MAX_BUNDLE_DIRECTORY];
+		char parm_name[MOD_HOUDINI_MAX_PARAMETER_NAME];
+		HAPI_StringHandle path_sh;
+		HAPI_ParmId parm_id;
+
+		H_CHECK(HAPI_GetNodePath(&hr->hsession, instance->sop_array[sid], -1, &path_sh));
+		H_CHECK(HAPI_GetString(&hr->hsession, path_sh, path, MAX_BUNDLE_DIRECTORY));
+
+		snprintf(parm_name, MOD_HOUDINI_MAX_PARAMETER_NAME, "objpath%d", sid + 1);
+		H_CHECK(HAPI_GetParmIdFromName(&hr->hsession, instance->merge_input_id, parm_name, &parm_id));
+		H_CHECK(HAPI_SetParmStringValue(&hr->hsession, instance->merge_input_id, path, parm_id, 0));
+	}
+
+	return true;
+}
+
+/**
+ * In merge mode, the display SOPs are merged and their packed primitives
+ * unpacked by a network built next to the asset, and the output of this
+ * network replaces the list of SOPs. This way, outputs made of many parts
+ * (fractures, copies, etc.) come in as few parts as possible, i.e. with as
+ * few calls as possible.
+ */
+static bool hruntime_merge_sops(HoudiniRuntime* hr, HoudiniInstance* instance) {
+	if (instance->sops_changed || -1 == instance->merge_geo_id) {
+		if (!hruntime_update_merge_network(hr, instance)) {
+			hruntime_delete_merge_network(hr, instance);
+			return false;
+		}
+	}
+
+	if (!hruntime_cook_node(hr, instance->merge_output_id, NULL, -1, NULL, NULL)) {
+		return false;
+	}
+
+	hr->sop_array = &instance->merge_output_id;
+	hr->sop_count = 1;
+	return true;
+}
+
+bool hruntime_fetch_sops(HoudiniRuntime* hr, HoudiniInstance* instance) {
+	if (!hruntime_list_sops(hr, instance)) {
+		return false;
+	}
+
+	if (hr->merge_parts && instance->sop_count > 0 && !hruntime_merge_sops(hr, instance)) {
+		HLOG_WARNING(HLOG_GEO, "Could not merge output parts, reading display SOPs directly.");
+		hr->sop_array = instance->sop_array;
+		hr->sop_count = instance->sop_count;
+	}
+
+	return true;
+}
+
+/**
+ * Point clouds and particles come as parts with points only. Houdini does
+ * not give them the mesh type in all cases.
+ */
+static bool is_point_cloud(const HAPI_PartInfo* part_info) {
+	return (HAPI_PARTTYPE_MESH == part_info->type || HAPI_PARTTYPE_INVALID == part_info->type)
+		&& part_info->pointCount > 0
+		&& 0 == part_info->vertexCount
+		&& 0 == part_info->faceCount;
+}
+
+/**
+ * Whether a part holds a mesh or point cloud
+ */
+static bool is_mesh_part(const HAPI_PartInfo* part_info) {
+	return HAPI_PARTTYPE_MESH == part_info->type || is_point_cloud(part_info);
+}
+
+/**
+ * Whether a part is output as is, rather than only used as an instance
+ * source or ignored.
+ */
+static bool is_output_mesh(const HAPI_PartInfo* part_info) {
+	return is_mesh_part(part_info) && !part_info->isInstanced;
+}
+
+// private
+static void hruntime_push_part_layout(HoudiniRuntime* hr, const HAPI_PartInfo* part_info) {
+	if (hr->part_count == hr->part_capacity) {
+		int capacity = max(8, 2 * hr->part_capacity);
+		HoudiniPartLayout* part_array = malloc_array(sizeof(HoudiniPartLayout), capacity, "houdini part layout");
+		if (NULL != hr->part_array) {
+			memcpy(part_array, hr->part_array, sizeof(HoudiniPartLayout) * hr->part_count);
+			free_array(hr->part_array);
+		}
+		hr->part_array = part_array;
+		hr->part_capacity = capacity;
+	}
+	HoudiniPartLayout* layout = &hr->part_array[hr->part_count++];
+	layout->type = part_info->type;
+	layout->point_count = part_info->pointCount;
+	layout->vertex_count = part_info->vertexCount;
+	layout->face_count = part_info->faceCount;
+	layout->instance_count = HAPI_PARTTYPE_INSTANCER == part_info->type ? part_info->instanceCount : 0;
+}
+
+/**
+ * List the mesh parts instanced by an instancer part. Other instanced parts
+ * are ignored.
+ */
+static bool hruntime_fetch_instancer(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, HAPI_PartId part_id, const HAPI_PartInfo* part_info,
+	HoudiniInstancer* instancer) {
+	HAPI_Result res;
+	instancer->instance_count = part_info->instanceCount;
+	instancer->source_count = 0;
+	instancer->source_infos = NULL;
+	instancer->point_count = 0;
+	instancer->vertex_count = 0;
+	instancer->face_count = 0;
+
+	int instanced_count = part_info->instancedPartCount;
+	if (instanced_count <= 0) {
 		return true;
 	}
 
-	case HAPI_NODETYPE_OBJ:
+	HAPI_PartId* part_ids = malloc_array(sizeof(HAPI_PartId), instanced_count, "houdini instanced parts");
+	H_CHECK_OR(HAPI_GetInstancedPartIds(&hr->hsession, node_id, part_id, part_ids, 0, instanced_count))
+	{
+		free_array(part_ids);
+		return false;
+	}
+
+	instancer->source_infos = malloc_array(sizeof(HAPI_PartInfo), instanced_count, "houdini instanced parts");
+	for (int k = 0; k < instanced_count; ++k) {
+		HAPI_PartInfo* source_info = &instancer->source_infos[instancer->source_count];
+		H_CHECK_OR(HAPI_GetPartInfo(&hr->hsession, node_id, part_ids[k], source_info))
+			continue;
+
+		if (!is_mesh_part(source_info)) {
+			HLOG_TRACE(HLOG_GEO, "Ignoring non-mesh instanced part #%d.", part_ids[k]);
+			continue;
+		}
+
+		source_info->id = part_ids[k];
+		instancer->point_count += source_info->pointCount;
+		instancer->vertex_count += source_info->vertexCount;
+		instancer->face_count += source_info->faceCount;
+		++instancer->source_count;
+	}
+	free_array(part_ids);
+
+	HLOG_TRACE(HLOG_GEO, "Instancer with %d instances of %d mesh parts.", instancer->instance_count, instancer->source_count);
+	return true;
+}
+
+// private
+static void hruntime_free_instancer(HoudiniInstancer* instancer) {
+	if (NULL != instancer->source_infos) {
+		free_array(instancer->source_infos);
+		instancer->source_infos = NULL;
+	}
+}
+
+/**
+ * Number of output elements of a part, once instancers are expanded. Return
+ * false for parts that are not output by themselves, namely parts that are
+ * neither meshes nor instancers and meshes only used as instance sources.
+ */
+static bool hruntime_get_output_counts(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, HAPI_PartId part_id, const HAPI_PartInfo* part_info,
+	size_t* point_count, size_t* vertex_count, size_t* face_count) {
+	if (HAPI_PARTTYPE_INSTANCER == part_info->type) {
+		HoudiniInstancer instancer;
+		if (!hruntime_fetch_instancer(hr, node_id, part_id, part_info, &instancer)) {
+			return false;
+		}
+		*point_count = instancer.point_count * instancer.instance_count;
+		*vertex_count = instancer.vertex_count * instancer.instance_count;
+		*face_count = instancer.face_count * instancer.instance_count;
+		hruntime_free_instancer(&instancer);
+		return true;
+	}
+
+	if (!is_output_mesh(part_info)) {
+		return false;
+	}
+	*point_count = part_info->pointCount;
+	*vertex_count = part_info->vertexCount;
+	*face_count = part_info->faceCount;
+	return true;
+}
+
+void hruntime_consolidate_geo_counts(HoudiniRuntime* hr, int* point_count_ptr, int* vertex_count_ptr, int* face_count_ptr) {
+	hr->part_count = 0;
+	for (int sid = 0; sid < hr->sop_count; ++sid) {
+		HAPI_Result res;
+		HAPI_GeoInfo geo_info;
+		HAPI_NodeId node_id = hr->sop_array[sid];
+
+		HLOG_TRACE(HLOG_GEO, "Handling SOP #%d.", sid);
+
+		H_CHECK_OR(HAPI_GetGeoInfo(&hr->hsession, node_id, &geo_info))
+			continue;
+
+		if (geo_info.partCount == 0) {
+			hruntime_cook_node(hr, node_id, &hr->cook_options, -1, NULL, NULL);
+
+			H_CHECK_OR(HAPI_GetGeoInfo(&hr->hsession, node_id, &geo_info))
+				continue;
+		}
+
+		HLOG_TRACE(HLOG_GEO, "Geo of SOP #%d has %d parts and has type %d.", sid, geo_info.partCount, geo_info.type);
+
+		for (int i = 0; i < geo_info.partCount; ++i) {
+			HAPI_PartInfo part_info;
+			HAPI_PartId part_id = (HAPI_PartId)i;
+			H_CHECK_OR(HAPI_GetPartInfo(&hr->hsession, node_id, part_id, &part_info))
+				continue;
+
+			HLOG_TRACE(HLOG_GEO, "Part #%d: type %d, %d points, %d vertices, %d faces.", i, part_info.type, part_info.pointCount, part_info.vertexCount, part_info.faceCount);
+
+			hruntime_push_part_layout(hr, &part_info);
+
+			size_t part_point_count, part_vertex_count, part_face_count;
+			if (!hruntime_get_output_counts(hr, node_id, part_id, &part_info, &part_point_count, &part_vertex_count, &part_face_count)) {
+				HLOG_TRACE(HLOG_GEO, "Ignoring part that is not output.");
+				continue;
+			}
+
+			if (part_point_count > (size_t)(INT_MAX - *point_count_ptr)
+				|| part_vertex_count > (size_t)(INT_MAX - *vertex_count_ptr)
+				|| part_face_count > (size_t)(INT_MAX - *face_count_ptr)) {
+				// Remaining parts are ignored as well, see hruntime_fill_mesh
+				ERR("Output mesh exceeds %d elements, ignoring parts from #%d of SOP #%d\n", INT_MAX, i, sid);
+				--hr->part_count;
+				return;
+			}
+
+			*point_count_ptr += (int)part_point_count;
+			*vertex_count_ptr += (int)part_vertex_count;
+			*face_count_ptr += (int)part_face_count;
+		}
+	}
+}
+
+// private
+static size_t min_size(size_t a, size_t b) {
+	return (a < b) ? a : b;
+}
+
+// private
+static void copy_strided(char* dst, size_t dst_stride, const char* src, size_t src_stride, size_t element_size, size_t count) {
+	if (dst_stride == element_size && src_stride == element_size) {
+		memcpy(dst, src, element_size * count);
+		return;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		memcpy(dst + dst_stride * i, src + src_stride * i, element_size);
+	}
+}
+
+/**
+ * Number of elements of the given size that fit in a single HAPI transfer
+ */
+static int transfer_chunk_length(size_t element_size) {
+	size_t length = MOD_HOUDINI_MAX_TRANSFER_BYTES / element_size;
+	return length > 0 ? (int)length : 1;
+}
+
+/**
+ * The following wrappers split bulk transfers in chunks that Houdini Engine
+ * can address with int sizes, see MOD_HOUDINI_MAX_TRANSFER_BYTES.
+ */
+static bool hruntime_get_attribute_data(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, HAPI_PartId part_id, const char* attr_name,
+	HAPI_AttributeInfo* attr_info, HAPI_StorageType storage,
+	char* data, size_t stride, int first, int count) {
+	HAPI_Result res;
+	// HAPI counts the stride in components
+	int hapi_stride = (int)(stride / MOD_HOUDINI_COMPONENT_SIZE);
+	int chunk = transfer_chunk_length(stride);
+	for (int start = 0, length = 0; start < count; start += length) {
+		length = min(chunk, count - start);
+		HSTATS_BYTES(0, MOD_HOUDINI_COMPONENT_SIZE * attr_info->tupleSize * length);
+		if (HAPI_STORAGETYPE_INT == storage) {
+			H_CHECK(HAPI_GetAttributeIntData(&hr->hsession, node_id, part_id, attr_name, attr_info, hapi_stride, (int*)(data + stride * start), first + start, length));
+		} else {
+			H_CHECK(HAPI_GetAttributeFloatData(&hr->hsession, node_id, part_id, attr_name, attr_info, hapi_stride, (float*)(data + stride * start), first + start, length));
+		}
+	}
+	return true;
+}
+
+/**
+ * data is tightly packed, and made of ints or floats depending on the
+ * storage of attr_info.
+ */
+static bool hruntime_set_attribute_data(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, HAPI_PartId part_id, const char* attr_name,
+	const HAPI_AttributeInfo* attr_info, const char* data, int count) {
+	HAPI_Result res;
+	size_t stride = MOD_HOUDINI_COMPONENT_SIZE * attr_info->tupleSize;
+	int chunk = transfer_chunk_length(stride);
+	for (int start = 0, length = 0; start < count; start += length) {
+		length = min(chunk, count - start);
+		HSTATS_BYTES(stride * length, 0);
+		if (HAPI_STORAGETYPE_INT == attr_info->storage) {
+			H_CHECK(HAPI_SetAttributeIntData(&hr->hsession, node_id, part_id, attr_name, attr_info, (const int*)(data + stride * start), start, length));
+		} else {
+			H_CHECK(HAPI_SetAttributeFloatData(&hr->hsession, node_id, part_id, attr_name, attr_info, (const float*)(data + stride * start), start, length));
+		}
+	}
+	return true;
+}
+
+static bool hruntime_get_vertex_list(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, HAPI_PartId part_id, int* data, int count) {
+	HAPI_Result res;
+	int chunk = transfer_chunk_length(sizeof(int));
+	for (int start = 0, length = 0; start < count; start += length) {
+		length = min(chunk, count - start);
+		HSTATS_BYTES(0, sizeof(int) * length);
+		H_CHECK(HAPI_GetVertexList(&hr->hsession, node_id, part_id, data + start, start, length));
+	}
+	return true;
+}
+
+static bool hruntime_set_vertex_list(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, HAPI_PartId part_id, const int* data, int count) {
+	HAPI_Result res;
+	int chunk = transfer_chunk_length(sizeof(int));
+	for (int start = 0, length = 0; start < count; start += length) {
+		length = min(chunk, count - start);
+		HSTATS_BYTES(sizeof(int) * length, 0);
+		H_CHECK(HAPI_SetVertexList(&hr->hsession, node_id, part_id, data + start, start, length));
+	}
+	return true;
+}
+
+static bool hruntime_get_face_counts(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, HAPI_PartId part_id, int* data, int count) {
+	HAPI_Result res;
+	int chunk = transfer_chunk_length(sizeof(int));
+	for (int start = 0, length = 0; start < count; start += length) {
+		length = min(chunk, count - start);
+		HSTATS_BYTES(0, sizeof(int) * length);
+		H_CHECK(HAPI_GetFaceCounts(&hr->hsession, node_id, part_id, data + start, start, length));
+	}
+	return true;
+}
+
+static bool hruntime_set_face_counts(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, HAPI_PartId part_id, const int* data, int count) {
+	HAPI_Result res;
+	int chunk = transfer_chunk_length(sizeof(int));
+	for (int start = 0, length = 0; start < count; start += length) {
+		length = min(chunk, count - start);
+		HSTATS_BYTES(sizeof(int) * length, 0);
+		H_CHECK(HAPI_SetFaceCounts(&hr->hsession, node_id, part_id, data + start, start, length));
+	}
+	return true;
+}
+
+static bool hruntime_get_instancer_transforms(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, HAPI_PartId part_id, HAPI_Transform* data, int count) {
+	HAPI_Result res;
+	int chunk = transfer_chunk_length(sizeof(HAPI_Transform));
+	for (int start = 0, length = 0; start < count; start += length) {
+		length = min(chunk, count - start);
+		HSTATS_BYTES(0, sizeof(HAPI_Transform) * length);
+		H_CHECK(HAPI_GetInstancerPartTransforms(&hr->hsession, node_id, part_id, HAPI_SRT, data + start, start, length));
+	}
+	return true;
+}
+
+/**
+ * Whether HAPI can write the attribute right into the host buffer, using its
+ * stride argument, without overwriting data interleaved with it.
+ */
+static bool can_download_strided(const Attribute* attr, const HAPI_AttributeInfo* attr_info) {
+	return (MFX_FLOAT_ATTR == attr->type || MFX_INT_ATTR == attr->type)
+		&& attr->stride % MOD_HOUDINI_COMPONENT_SIZE == 0
+		&& attr->stride / MOD_HOUDINI_COMPONENT_SIZE <= INT_MAX
+		&& attr_info->tupleSize <= attr->componentCount;
+}
+
+/**
+ * Download count elements of an attribute into attr, starting at element
+ * first. Values are fetched as ints for int host attributes and as floats
+ * otherwise. Other layouts than the one of can_download_strided are streamed
+ * through a staging buffer of MOD_HOUDINI_STAGING_BYTES.
+ */
+static bool hruntime_download_attribute(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, HAPI_PartId part_id, const char* attr_name,
+	HAPI_AttributeInfo* attr_info, Attribute attr, size_t first, int count) {
+	char* dst = attr.data + attr.stride * first;
+	HAPI_StorageType storage = MFX_INT_ATTR == attr.type ? HAPI_STORAGETYPE_INT : HAPI_STORAGETYPE_FLOAT;
+	if (can_download_strided(&attr, attr_info)) {
+		return hruntime_get_attribute_data(hr, node_id, part_id, attr_name, attr_info, storage, dst, attr.stride, 0, count);
+	}
+
+	size_t houdini_stride = MOD_HOUDINI_COMPONENT_SIZE * attr_info->tupleSize;
+	int staging_length = (int)min_size((size_t)count, MOD_HOUDINI_STAGING_BYTES / houdini_stride + 1);
+	char* staging = malloc_array(houdini_stride, staging_length, "houdini attribute staging");
+	int component_count = min(attr.componentCount, attr_info->tupleSize);
+
+	for (int start = 0, length = 0; start < count; start += length) {
+		length = min(staging_length, count - start);
+		if (!hruntime_get_attribute_data(hr, node_id, part_id, attr_name, attr_info, storage, staging, houdini_stride, start, length)) {
+			free_array(staging);
+			return false;
+		}
+
+		char* chunk_dst = dst + attr.stride * start;
+		if (MFX_UBYTE_ATTR == attr.type) {
+			for (int i = 0; i < length; ++i) {
+				const float* src = (const float*)(staging + houdini_stride * i);
+				unsigned char* ubyte_dst = (unsigned char*)(chunk_dst + attr.stride * i);
+				for (int k = 0; k < component_count; ++k) {
+					float value = src[k] < 0.0f ? 0.0f : (src[k] > 1.0f ? 1.0f : src[k]);
+					ubyte_dst[k] = (unsigned char)(value * 255.0f + 0.5f);
+				}
+			}
+		} else {
+			copy_strided(chunk_dst, attr.stride, staging, houdini_stride, MOD_HOUDINI_COMPONENT_SIZE * component_count, length);
+		}
+	}
+	free_array(staging);
+	return true;
+}
+
+/**
+ * Download positions of a part into point_data, starting at point first_point
+ */
+static bool hruntime_fill_part_points(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, HAPI_PartId part_id, int part_point_count,
+	Attribute point_data, size_t first_point) {
+	HAPI_Result res;
+	HAPI_AttributeInfo pos_attr_info;
+	H_CHECK(HAPI_GetAttributeInfo(&hr->hsession, node_id, part_id, "P", HAPI_ATTROWNER_POINT, &pos_attr_info));
+	return hruntime_download_attribute(hr, node_id, part_id, "P", &pos_attr_info, point_data, first_point, part_point_count);
+}
+
+/**
+ * Expand an instancer part into the output buffers, from elements
+ * first_point, first_vertex and first_face on. Each source part is
+ * downloaded once then copied for each instance, all copies of a source
+ * being contiguous. Topology is not written when vertex_data is NULL.
+ */
+static bool hruntime_fill_instancer(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, HAPI_PartId part_id, const HoudiniInstancer* instancer,
+	Attribute point_data, size_t first_point,
+	const Attribute* vertex_data, size_t first_vertex,
+	const Attribute* face_data, size_t first_face) {
+	int instance_count = instancer->instance_count;
+	if (0 == instance_count || 0 == instancer->source_count) {
+		return true;
+	}
+
+	HAPI_Transform* transforms = malloc_array(sizeof(HAPI_Transform), instance_count, "houdini instance transforms");
+	if (!hruntime_get_instancer_transforms(hr, node_id, part_id, transforms, instance_count)) {
+		free_array(transforms);
+		return false;
+	}
+	float* matrices = malloc_array(12 * sizeof(float), instance_count, "houdini instance matrices");
+	hinstancer_transform_matrices(transforms, instance_count, matrices);
+	free_array(transforms);
+
+	bool success = true;
+	for (int s = 0; s < instancer->source_count && success; ++s) {
+		const HAPI_PartInfo* source_info = &instancer->source_infos[s];
+		HoudiniInstanceSource source;
+		source.point_count = source_info->pointCount;
+		source.vertex_count = source_info->vertexCount;
+		source.face_count = source_info->faceCount;
+
+		Attribute source_points = point_data;
+		source_points.stride = 3 * sizeof(float);
+		source_points.data = malloc_array(source_points.stride, source.point_count, "houdini instanced points");
+		int* source_vertices = NULL;
+		int* source_face_counts = NULL;
+
+		success = hruntime_fill_part_points(hr, node_id, source_info->id, source.point_count, source_points, 0);
+		if (success && NULL != vertex_data) {
+			source_vertices = malloc_array(sizeof(int), source.vertex_count, "houdini instanced vertex list");
+			source_face_counts = malloc_array(sizeof(int), source.face_count, "houdini instanced face list");
+			success =
+				hruntime_get_vertex_list(hr, node_id, source_info->id, source_vertices, source.vertex_count)
+				&& hruntime_get_face_counts(hr, node_id, source_info->id, source_face_counts, source.face_count);
+		}
+
+		if (success) {
+			source.points = (const float*)source_points.data;
+			source.vertices = source_vertices;
+			source.face_counts = source_face_counts;
+			hinstancer_expand(&source, matrices, instance_count,
+				point_data, first_point, vertex_data, first_vertex, face_data, first_face);
+		}
+
+		free_array(source_points.data);
+		if (NULL != source_vertices) free_array(source_vertices);
+		if (NULL != source_face_counts) free_array(source_face_counts);
+
+		first_point += (size_t)source.point_count * instance_count;
+		first_vertex += (size_t)source.vertex_count * instance_count;
+		first_face += (size_t)source.face_count * instance_count;
+	}
+
+	free_array(matrices);
+	return success;
+}
+
+void hruntime_fill_mesh(HoudiniRuntime* hr,
+	Attribute point_data, int point_count,
+	Attribute vertex_data, int vertex_count,
+	Attribute face_data, int face_count) {
+	size_t current_point = 0, current_vertex = 0, current_face = 0;
+	size_t minimum_point_stride = point_data.componentCount * attributeTypeByteSize(point_data.type);
+	assert(minimum_point_stride == 3 * sizeof(float));
+
+	size_t minimum_face_stride = face_data.componentCount * attributeTypeByteSize(face_data.type);
+	assert(minimum_face_stride == 1 * sizeof(int));
+	bool is_face_contiguous = face_data.stride == minimum_face_stride;
+
+	for (int sid = 0; sid < hr->sop_count; ++sid) {
+		HAPI_Result res;
+		HAPI_GeoInfo geo_info;
+		HAPI_NodeId node_id = hr->sop_array[sid];
+
+		HLOG_TRACE(HLOG_GEO, "Loading SOP #%d.", sid);
+
+		H_CHECK_OR(HAPI_GetGeoInfo(&hr->hsession, node_id, &geo_info))
+			continue;
+
+		for (int i = 0; i < geo_info.partCount; ++i) {
+			HAPI_PartInfo part_info;
+			HAPI_PartId part_id = (HAPI_PartId)i;
+
+			H_CHECK_OR(HAPI_GetPartInfo(&hr->hsession, node_id, part_id, &part_info))
+				continue;
+
+			HLOG_TRACE(HLOG_GEO, "Part #%d: type %d, %d points, %d vertices, %d faces.", i, part_info.type, part_info.pointCount, part_info.vertexCount, part_info.faceCount);
+
+			if (HAPI_PARTTYPE_INSTANCER == part_info.type) {
+				HoudiniInstancer instancer;
+				if (!hruntime_fetch_instancer(hr, node_id, part_id, &part_info, &instancer)) {
+					continue;
+				}
+
+				size_t part_point_count = instancer.point_count * instancer.instance_count;
+				size_t part_vertex_count = instancer.vertex_count * instancer.instance_count;
+				size_t part_face_count = instancer.face_count * instancer.instance_count;
+				if (part_point_count > (size_t)point_count - current_point
+					|| part_vertex_count > (size_t)vertex_count - current_vertex
+					|| part_face_count > (size_t)face_count - current_face) {
+					hruntime_free_instancer(&instancer);
+					return;
+				}
+
+				if (hruntime_fill_instancer(hr, node_id, part_id, &instancer,
+					point_data, current_point,
+					&vertex_data, current_vertex,
+					&face_data, current_face)) {
+					current_point += part_point_count;
+					current_vertex += part_vertex_count;
+					current_face += part_face_count;
+				}
+				hruntime_free_instancer(&instancer);
+				continue;
+			}
+
+			if (!is_output_mesh(&part_info)) {
+				HLOG_TRACE(HLOG_GEO, "Ignoring part that is not output.");
+				continue;
+			}
+
+			// Parts beyond what hruntime_consolidate_geo_counts could count
+			if ((size_t)part_info.pointCount > (size_t)point_count - current_point
+				|| (size_t)part_info.vertexCount > (size_t)vertex_count - current_vertex
+				|| (size_t)part_info.faceCount > (size_t)face_count - current_face) {
+				return;
+			}
+
+			if (!hruntime_fill_part_points(hr, node_id, part_id, part_info.pointCount, point_data, current_point)) {
+				continue;
+			}
+
+			// Point clouds have no topology to download
+			if (is_point_cloud(&part_info)) {
+				current_point += part_info.pointCount;
+				continue;
+			}
+
+			// Get Vertex Data
+			int* part_vertex_data = malloc_array(sizeof(int), part_info.vertexCount, "houdini vertex list");
+			if (!hruntime_get_vertex_list(hr, node_id, part_id, part_vertex_data, part_info.vertexCount))
+			{
+				free_array(part_vertex_data);
+				continue;
+			}
+
+			// TODO: can be vectorized
+			for (int vid = 0; vid < part_info.vertexCount; ++vid) {
+				int* v = (int*)(vertex_data.data + vertex_data.stride * (current_vertex + vid));
+				*v = (int)current_point + part_vertex_data[vid];
+			}
+			free_array(part_vertex_data);
+
+			// Get face data
+			char* part_face_data =
+				is_face_contiguous
+				? face_data.data + face_data.stride * current_face
+				: malloc_array(minimum_face_stride, part_info.faceCount, "houdini face list");
+
+			if (!hruntime_get_face_counts(hr, node_id, part_id, (int*)part_face_data, part_info.faceCount))
+			{
+				if (!is_face_contiguous) free_array(part_face_data);
+				continue;
+			}
+
+			if (!is_face_contiguous)
+			{
+				copy_strided(
+					face_data.data + face_data.stride * current_face, face_data.stride,
+					part_face_data, minimum_face_stride,
+					minimum_face_stride, part_info.faceCount);
+				free_array(part_face_data);
+			}
+
+			current_point += part_info.pointCount;
+			current_vertex += part_info.vertexCount;
+			current_face += part_info.faceCount;
+		}
+	}
+}
+
+void hruntime_fill_points(HoudiniRuntime* hr, Attribute point_data) {
+	size_t current_point = 0;
+
+	for (int sid = 0; sid < hr->sop_count; ++sid) {
+		HAPI_Result res;
+		HAPI_GeoInfo geo_info;
+		HAPI_NodeId node_id = hr->sop_array[sid];
+
+		H_CHECK_OR(HAPI_GetGeoInfo(&hr->hsession, node_id, &geo_info))
+			continue;
+
+		for (int i = 0; i < geo_info.partCount; ++i) {
+			HAPI_PartInfo part_info;
+			HAPI_PartId part_id = (HAPI_PartId)i;
+
+			H_CHECK_OR(HAPI_GetPartInfo(&hr->hsession, node_id, part_id, &part_info))
+				continue;
+
+			if (HAPI_PARTTYPE_INSTANCER == part_info.type) {
+				HoudiniInstancer instancer;
+				if (hruntime_fetch_instancer(hr, node_id, part_id, &part_info, &instancer)) {
+					hruntime_fill_instancer(hr, node_id, part_id, &instancer, point_data, current_point, NULL, 0, NULL, 0);
+					current_point += instancer.point_count * instancer.instance_count;
+					hruntime_free_instancer(&instancer);
+				}
+				continue;
+			}
+
+			if (!is_output_mesh(&part_info)) {
+				continue;
+			}
+
+			hruntime_fill_part_points(hr, node_id, part_id, part_info.pointCount, point_data, current_point);
+			current_point += part_info.pointCount;
+		}
+	}
+}
+
+/**
+ * Whether an output mapping can be served by an attribute of the given owner.
+ * Point attributes are expanded to vertices by the plugin, which spares HDAs
+ * an Attribute Promote SOP and transfers less data.
+ */
+static bool output_mapping_accepts(const HoudiniAttributeMapping* mapping, HAPI_AttributeOwner owner) {
+	return HATTRIB_OUTPUT == mapping->direction
+		&& (owner == mapping->owner
+			|| (HAPI_ATTROWNER_VERTEX == mapping->owner && HAPI_ATTROWNER_POINT == owner));
+}
+
+/**
+ * Record that the attribute of the given mapping exists on a part, with the
+ * given owner.
+ */
+static void hruntime_add_output_attribute(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, HAPI_PartId part_id, int mapping_index, HAPI_AttributeOwner owner) {
+	HAPI_Result res;
+	const HoudiniAttributeMapping* mapping = &hr->attribute_map.mappings[mapping_index];
+
+	HAPI_AttributeInfo attr_info;
+	H_CHECK_OR(HAPI_GetAttributeInfo(&hr->hsession, node_id, part_id, mapping->houdini_name, owner, &attr_info))
+		return;
+
+	HAPI_StorageType storage;
+	switch (attr_info.storage) {
+	case HAPI_STORAGETYPE_INT:
+		storage = HAPI_STORAGETYPE_INT;
+		break;
+	case HAPI_STORAGETYPE_FLOAT:
+		storage = HAPI_STORAGETYPE_FLOAT;
+		break;
+	default:
+		HLOG_DEBUG(HLOG_GEO, "Attribute %s has unsupported storage %d", mapping->houdini_name, attr_info.storage);
+		return;
+	}
+
+	for (int a = 0; a < hr->output_attribute_count; ++a) {
+		HoudiniOutputAttribute* attr = &hr->output_attribute_array[a];
+		if (attr->mapping_index == mapping_index) {
+			attr->tuple_size = max(attr->tuple_size, attr_info.tupleSize);
+			// Parts disagreeing on the type fall back to floats
+			if (attr->storage != storage) {
+				attr->storage = HAPI_STORAGETYPE_FLOAT;
+			}
+			return;
+		}
+	}
+
+	HoudiniOutputAttribute* attr = &hr->output_attribute_array[hr->output_attribute_count++];
+	attr->mapping_index = mapping_index;
+	attr->owner = mapping->owner;
+	attr->storage = storage;
+	attr->tuple_size = attr_info.tupleSize;
+}
+
+/**
+ * Match the names of the attributes of a part with the output mappings
+ */
+static void hruntime_find_part_attributes(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, HAPI_PartId part_id, HAPI_AttributeOwner owner, int name_count) {
+	HAPI_Result res;
+	const HoudiniAttributeMap* map = &hr->attribute_map;
+
+	bool has_mapping = false;
+	for (int m = 0; m < map->count && !has_mapping; ++m) {
+		has_mapping = output_mapping_accepts(&map->mappings[m], owner);
+	}
+	if (!has_mapping || 0 == name_count) {
+		return;
+	}
+
+	HAPI_StringHandle* name_handles = malloc_array(sizeof(HAPI_StringHandle), name_count, "houdini attribute names");
+	H_CHECK_OR(HAPI_GetAttributeNames(&hr->hsession, node_id, part_id, owner, name_handles, name_count))
+	{
+		free_array(name_handles);
+		return;
+	}
+
+	// Resolve all names at once rather than with one round trip each
+	int buffer_size = 0;
+	H_CHECK_OR(HAPI_GetStringBatchSize(&hr->hsession, name_handles, name_count, &buffer_size))
+	{
+		free_array(name_handles);
+		return;
+	}
+	free_array(name_handles);
+
+	char* names = malloc_array(sizeof(char), buffer_size, "houdini attribute names");
+	H_CHECK_OR(HAPI_GetStringBatch(&hr->hsession, names, buffer_size))
 	{
-		H_CHECK(HAPI_ComposeChildNodeList(&hr->hsession, hr->node_id, HAPI_NODETYPE_SOP, HAPI_NODEFLAGS_DISPLAY, true, &hr->sop_count));
-
-		hr->sop_array = malloc_array(sizeof(HAPI_NodeId), hr->sop_count, "houdini cooked SOPs");
-
-		H_CHECK(HAPI_GetComposedChildNodeList(&hr->hsession, hr->node_id, hr->sop_array, hr->sop_count));
-
-		printf("Asset has %d Display SOP(s).\n", hr->sop_count);
-		return true;
+		free_array(names);
+		return;
 	}
 
-	default:
-		printf("Houdini modifier for Blender only supports SOP and OBJ digital asset, but this asset has type %d.\n", node_info.type);
-		return false;
+	const char* name = names;
+	for (int k = 0; k < name_count && name < names + buffer_size; ++k) {
+		for (int m = 0; m < map->count; ++m) {
+			const HoudiniAttributeMapping* mapping = &map->mappings[m];
+			if (output_mapping_accepts(mapping, owner) && 0 == strcmp(mapping->houdini_name, name)) {
+				hruntime_add_output_attribute(hr, node_id, part_id, m, owner);
+			}
+		}
+		name += strlen(name) + 1;
 	}
+	free_array(names);
 }
 
-void hruntime_consolidate_geo_counts(HoudiniRuntime* hr, int* point_count_ptr, int* vertex_count_ptr, int* face_count_ptr) {
+void hruntime_find_output_attributes(HoudiniRuntime* hr) {
+	HAPI_Result res;
+	hr->output_attribute_count = 0;
+
 	for (int sid = 0; sid < hr->sop_count; ++sid) {
-		HAPI_Result res;
 		HAPI_GeoInfo geo_info;
 		HAPI_NodeId node_id = hr->sop_array[sid];
 
-		printf("Handling SOP #%d.\n", sid);
-
 		H_CHECK_OR(HAPI_GetGeoInfo(&hr->hsession, node_id, &geo_info))
 			continue;
 
-		if (geo_info.partCount == 0) {
-			H_CHECK_OR(HAPI_CookNode(&hr->hsession, node_id, NULL)) {}
-
-			H_CHECK_OR(HAPI_GetGeoInfo(&hr->hsession, node_id, &geo_info))
-				continue;
-		}
-
-		char name[256];
-		HAPI_GetString(&hr->hsession, geo_info.nameSH, name, 256);
-		printf("Geo '%s' has %d parts and has type %d.\n", name, geo_info.partCount, geo_info.type);
-
 		for (int i = 0; i < geo_info.partCount; ++i) {
 			HAPI_PartInfo part_info;
 			HAPI_PartId part_id = (HAPI_PartId)i;
+
 			H_CHECK_OR(HAPI_GetPartInfo(&hr->hsession, node_id, part_id, &part_info))
 				continue;
 
-			printf("Part #%d: type %d, %d points, %d vertices, %d faces.\n", i, part_info.type, part_info.pointCount, part_info.vertexCount, part_info.faceCount);
-
-			if (part_info.type != HAPI_PARTTYPE_MESH) {
-				printf("Ignoring non-mesh part.\n");
+			if (!is_mesh_part(&part_info)) {
 				continue;
 			}
 
-			*point_count_ptr += part_info.pointCount;
-			*vertex_count_ptr += part_info.vertexCount;
-			*face_count_ptr += part_info.faceCount;
+			for (int owner = 0; owner < HAPI_ATTROWNER_MAX; ++owner) {
+				hruntime_find_part_attributes(hr, node_id, part_id, (HAPI_AttributeOwner)owner, part_info.attributeCounts[owner]);
+			}
 		}
 	}
 }
 
-bool hruntime_has_vertex_attribute(HoudiniRuntime* hr, const char *attr_name)
-{
-	HAPI_Result res;
-	HAPI_GeoInfo geo_info;
-	HAPI_PartInfo part_info;
+// private
+static void zero_strided(char* dst, size_t dst_stride, size_t element_size, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		memset(dst + dst_stride * i, 0, element_size);
+	}
+}
 
-	for (int sid = 0; sid < hr->sop_count; ++sid) {
-		HAPI_NodeId node_id = hr->sop_array[sid];
+// private
+static void zero_attribute(Attribute attr, size_t first, size_t count) {
+	if (NULL != attr.data) {
+		zero_strided(attr.data + attr.stride * first, attr.stride, attr.componentCount * attributeTypeByteSize(attr.type), count);
+	}
+}
 
-		H_CHECK_OR(HAPI_GetGeoInfo(&hr->hsession, node_id, &geo_info))
-			continue;
+/**
+ * Expand the packed values of the points of a part to its count vertices,
+ * starting at element first_vertex of dst. Vertex points are read back from
+ * the host's vertex list, in which the part's points start at first_point.
+ * Fixed element sizes let the compiler turn the copy into plain loads and
+ * stores.
+ */
+static void gather_point_values(Attribute dst, size_t first_vertex,
+	const char* src, size_t element_size, int point_count,
+	Attribute vertex_data, size_t first_point, int count) {
+	char* dst_data = dst.data + dst.stride * first_vertex;
+	const char* vertex_points = vertex_data.data + vertex_data.stride * first_vertex;
+
+#define GATHER_LOOP(size) \
+	for (int i = 0; i < count; ++i) { \
+		size_t point = (size_t)*(const int*)(vertex_points + vertex_data.stride * i) - first_point; \
+		if (point < (size_t)point_count) { \
+			memcpy(dst_data + dst.stride * i, src + (size) * point, (size)); \
+		} else { \
+			memset(dst_data + dst.stride * i, 0, (size)); \
+		} \
+	}
 
-		for (int i = 0; i < geo_info.partCount; ++i) {
-			HAPI_PartId part_id = (HAPI_PartId)i;
+	switch (element_size) {
+	case 4: GATHER_LOOP(4) break;
+	case 8: GATHER_LOOP(8) break;
+	case 12: GATHER_LOOP(12) break;
+	case 16: GATHER_LOOP(16) break;
+	default: GATHER_LOOP(element_size) break;
+	}
 
-			H_CHECK_OR(HAPI_GetPartInfo(&hr->hsession, node_id, part_id, &part_info))
-				continue;
+#undef GATHER_LOOP
+}
 
-			if (part_info.type != HAPI_PARTTYPE_MESH)
-				continue;
+/**
+ * Fill the vertex attribute attr_data with the values of the point attribute
+ * described by attr_info, see gather_point_values.
+ */
+static bool hruntime_download_point_attribute_to_vertices(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, HAPI_PartId part_id, const char* attr_name,
+	HAPI_AttributeInfo* attr_info, Attribute attr_data, size_t first_vertex,
+	Attribute vertex_data, size_t first_point, int point_count, int vertex_count) {
+	Attribute point_values = attr_data;
+	point_values.stride = attr_data.componentCount * attributeTypeByteSize(attr_data.type);
+	point_values.data = malloc_array(point_values.stride, point_count, "houdini point attribute");
+
+	bool success = hruntime_download_attribute(hr, node_id, part_id, attr_name, attr_info, point_values, 0, point_count);
+	if (success) {
+		gather_point_values(attr_data, first_vertex, point_values.data, point_values.stride, point_count, vertex_data, first_point, vertex_count);
+	}
+	free_array(point_values.data);
+	return success;
+}
 
-			HAPI_AttributeInfo attr_info;
-			H_CHECK_OR(HAPI_GetAttributeInfo(&hr->hsession, node_id, part_id, attr_name, HAPI_ATTROWNER_VERTEX, &attr_info))
-				continue;
+/**
+ * Download the output attributes of a mesh part, whose elements start at
+ * first_point, first_vertex and first_face in the output.
+ */
+static void hruntime_fill_part_attributes(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, HAPI_PartId part_id, const HAPI_PartInfo* part_info,
+	const Attribute* attr_data_array, Attribute vertex_data, bool* has_detail,
+	size_t first_point, size_t first_vertex, size_t first_face) {
+	HAPI_Result res;
+	for (int a = 0; a < hr->output_attribute_count; ++a) {
+		const HoudiniOutputAttribute* attr = &hr->output_attribute_array[a];
+		const HoudiniAttributeMapping* mapping = &hr->attribute_map.mappings[attr->mapping_index];
+		Attribute attr_data = attr_data_array[a];
+		if (NULL == attr_data.data || (HAPI_ATTROWNER_DETAIL == attr->owner && has_detail[a])) {
+			continue;
+		}
+
+		size_t first =
+			HAPI_ATTROWNER_POINT == attr->owner ? first_point
+			: HAPI_ATTROWNER_VERTEX == attr->owner ? first_vertex
+			: HAPI_ATTROWNER_PRIM == attr->owner ? first_face
+			: 0;
+		int count = hattrib_owner_element_count(attr->owner, part_info->pointCount, part_info->vertexCount, part_info->faceCount);
+
+		HAPI_AttributeInfo attr_info;
+		attr_info.exists = false;
+		H_CHECK_OR(HAPI_GetAttributeInfo(&hr->hsession, node_id, part_id, mapping->houdini_name, attr->owner, &attr_info)) {}
+
+		bool success;
+		if (attr_info.exists) {
+			success = hruntime_download_attribute(hr, node_id, part_id, mapping->houdini_name, &attr_info, attr_data, first, count);
+		} else if (HAPI_ATTROWNER_VERTEX == attr->owner) {
+			// Fall back to a point attribute, expanded here rather than promoted in Houdini
+			H_CHECK_OR(HAPI_GetAttributeInfo(&hr->hsession, node_id, part_id, mapping->houdini_name, HAPI_ATTROWNER_POINT, &attr_info)) {}
+			success =
+				attr_info.exists
+				&& hruntime_download_point_attribute_to_vertices(hr, node_id, part_id, mapping->houdini_name, &attr_info,
+					attr_data, first, vertex_data, first_point, part_info->pointCount, count);
+		} else {
+			success = false;
+		}
 
-			if (attr_info.exists) return true;
+		if (HAPI_ATTROWNER_DETAIL == attr->owner) {
+			has_detail[a] = success;
+		} else if (!success) {
+			zero_attribute(attr_data, first, count);
 		}
 	}
-	return false;
 }
 
-void hruntime_fill_mesh(HoudiniRuntime* hr,
-	Attribute point_data, int point_count,
-	Attribute vertex_data, int vertex_count,
-	Attribute face_data, int face_count) {
-	int current_point = 0, current_vertex = 0, current_face = 0;
-	size_t minimum_point_stride = point_data.componentCount * attributeTypeByteSize(point_data.type);
-	assert(minimum_point_stride == 3 * sizeof(float));
-	bool is_point_contiguous = point_data.stride == minimum_point_stride;
+/**
+ * Download the attributes of the first copy of each source of an instancer,
+ * then replicate them to the other copies (see hruntime_fill_instancer).
+ */
+static void hruntime_fill_instancer_attributes(HoudiniRuntime* hr,
+	HAPI_NodeId node_id, const HoudiniInstancer* instancer,
+	const Attribute* attr_data_array, Attribute vertex_data, bool* has_detail,
+	size_t first_point, size_t first_vertex, size_t first_face) {
+	int instance_count = instancer->instance_count;
+	if (0 == instance_count) {
+		return;
+	}
 
-	size_t minimum_face_stride = face_data.componentCount * attributeTypeByteSize(face_data.type);
-	assert(minimum_face_stride == 1 * sizeof(int));
-	bool is_face_contiguous = face_data.stride == minimum_face_stride;
+	for (int s = 0; s < instancer->source_count; ++s) {
+		const HAPI_PartInfo* source_info = &instancer->source_infos[s];
+		hruntime_fill_part_attributes(hr, node_id, source_info->id, source_info,
+			attr_data_array, vertex_data, has_detail,
+			first_point, first_vertex, first_face);
+
+		for (int a = 0; a < hr->output_attribute_count; ++a) {
+			HAPI_AttributeOwner owner = hr->output_attribute_array[a].owner;
+			size_t first =
+				HAPI_ATTROWNER_POINT == owner ? first_point
+				: HAPI_ATTROWNER_VERTEX == owner ? first_vertex
+				: HAPI_ATTROWNER_PRIM == owner ? first_face
+				: 0;
+			if (HAPI_ATTROWNER_DETAIL != owner) {
+				int count = hattrib_owner_element_count(owner, source_info->pointCount, source_info->vertexCount, source_info->faceCount);
+				hinstancer_replicate(attr_data_array[a], first, (size_t)count, instance_count);
+			}
+		}
+
+		first_point += (size_t)source_info->pointCount * instance_count;
+		first_vertex += (size_t)source_info->vertexCount * instance_count;
+		first_face += (size_t)source_info->faceCount * instance_count;
+	}
+}
+
+void hruntime_fill_attributes(HoudiniRuntime* hr,
+	const Attribute* attr_data_array, Attribute vertex_data,
+	int point_count, int vertex_count, int face_count) {
+	if (0 == hr->output_attribute_count) {
+		return;
+	}
+
+	size_t current_point = 0, current_vertex = 0, current_face = 0;
+	// Detail attributes are read from the first part that has them
+	bool* has_detail = malloc_array(sizeof(bool), hr->output_attribute_count, "houdini detail attribute flags");
+	memset(has_detail, 0, sizeof(bool) * hr->output_attribute_count);
 
 	for (int sid = 0; sid < hr->sop_count; ++sid) {
 		HAPI_Result res;
 		HAPI_GeoInfo geo_info;
 		HAPI_NodeId node_id = hr->sop_array[sid];
 
-		printf("Loading SOP #%d.\n", sid);
-
 		H_CHECK_OR(HAPI_GetGeoInfo(&hr->hsession, node_id, &geo_info))
 			continue;
 
@@ -470,212 +2400,435 @@ void hruntime_fill_mesh(HoudiniRuntime* hr,
 			H_CHECK_OR(HAPI_GetPartInfo(&hr->hsession, node_id, part_id, &part_info))
 				continue;
 
-			printf("Part #%d: type %d, %d points, %d vertices, %d faces.\n", i, part_info.type, part_info.pointCount, part_info.vertexCount, part_info.faceCount);
-
-			if (part_info.type != HAPI_PARTTYPE_MESH) {
-				printf("Ignoring non-mesh part.\n");
-				continue;
-			}
-
-			HAPI_AttributeInfo pos_attr_info;
-			H_CHECK_OR(HAPI_GetAttributeInfo(&hr->hsession, node_id, part_id, "P", HAPI_ATTROWNER_POINT, &pos_attr_info))
-				continue;
-
-			// Get Point data
-			char* part_point_data =
-				is_point_contiguous
-				? point_data.data + point_data.stride * current_point
-				: malloc_array(minimum_point_stride, part_info.pointCount, "houdini point list");
-			H_CHECK_OR(HAPI_GetAttributeFloatData(&hr->hsession, node_id, part_id, "P", &pos_attr_info, -1, (float*)part_point_data, 0, part_info.pointCount))
-			{
-				if (!is_point_contiguous) free_array(part_point_data);
-				continue;
-			}
-
-			if (!is_point_contiguous)
-			{
-				// TODO: can be vectorized
-				for (int i = 0; i < part_info.pointCount; ++i) {
-					memcpy(
-						point_data.data + point_data.stride * (current_point + i),
-						part_point_data + minimum_point_stride * i,
-						minimum_point_stride);
+			HoudiniInstancer instancer;
+			size_t part_point_count, part_vertex_count, part_face_count;
+			if (HAPI_PARTTYPE_INSTANCER == part_info.type) {
+				if (!hruntime_fetch_instancer(hr, node_id, part_id, &part_info, &instancer)) {
+					continue;
 				}
-				free_array(part_point_data);
+				part_point_count = instancer.point_count * instancer.instance_count;
+				part_vertex_count = instancer.vertex_count * instancer.instance_count;
+				part_face_count = instancer.face_count * instancer.instance_count;
+			} else if (is_output_mesh(&part_info)) {
+				instancer.source_infos = NULL;
+				part_point_count = part_info.pointCount;
+				part_vertex_count = part_info.vertexCount;
+				part_face_count = part_info.faceCount;
+			} else {
+				continue;
 			}
 
-			// Get Vertex Data
-			int* part_vertex_data = malloc_array(sizeof(int), part_info.vertexCount, "houdini vertex list");
-			H_CHECK_OR(HAPI_GetVertexList(&hr->hsession, node_id, part_id, part_vertex_data, 0, part_info.vertexCount))
-			{
-				free_array(part_vertex_data);
-				continue;
+			// Parts beyond what hruntime_consolidate_geo_counts could count
+			if (part_point_count > (size_t)point_count - current_point
+				|| part_vertex_count > (size_t)vertex_count - current_vertex
+				|| part_face_count > (size_t)face_count - current_face) {
+				hruntime_free_instancer(&instancer);
+				sid = hr->sop_count;
+				break;
 			}
 
-			// TODO: can be vectorized
-			for (int vid = 0; vid < part_info.vertexCount; ++vid) {
-				int* v = (int*)(vertex_data.data + vertex_data.stride * (current_vertex + vid));
-				*v = current_point + part_vertex_data[vid];
+			if (HAPI_PARTTYPE_INSTANCER == part_info.type) {
+				hruntime_fill_instancer_attributes(hr, node_id, &instancer,
+					attr_data_array, vertex_data, has_detail,
+					current_point, current_vertex, current_face);
+				hruntime_free_instancer(&instancer);
+			} else {
+				hruntime_fill_part_attributes(hr, node_id, part_id, &part_info,
+					attr_data_array, vertex_data, has_detail,
+					current_point, current_vertex, current_face);
 			}
-			free_array(part_vertex_data);
 
-			// Get face data
-			char* part_face_data =
-				is_face_contiguous
-				? face_data.data + face_data.stride * current_face
-				: malloc_array(minimum_face_stride, part_info.faceCount, "houdini face list");
+			current_point += part_point_count;
+			current_vertex += part_vertex_count;
+			current_face += part_face_count;
+		}
+	}
 
-			H_CHECK_OR(HAPI_GetFaceCounts(&hr->hsession, node_id, part_id, (int*)part_face_data, 0, part_info.faceCount))
-			{
-				if (!is_face_contiguous) free_array(part_face_data);
-				continue;
-			}
+	for (int a = 0; a < hr->output_attribute_count; ++a) {
+		if (HAPI_ATTROWNER_DETAIL == hr->output_attribute_array[a].owner && !has_detail[a]) {
+			zero_attribute(attr_data_array[a], 0, 1);
+		}
+	}
+	free_array(has_detail);
+}
 
-			if (!is_face_contiguous)
-			{
-				// TODO: can be vectorized
-				for (int i = 0; i < part_info.faceCount; ++i) {
-					memcpy(
-						face_data.data + face_data.stride * (current_face + i),
-						part_face_data + minimum_face_stride * i,
-						minimum_face_stride);
-				}
-				free_array(part_face_data);
-			}
+bool hruntime_poll_geo_changes(HoudiniRuntime* hr, HoudiniInstance* instance) {
+	HAPI_Result res;
+	bool changed = instance->sops_changed;
+	instance->sops_changed = false;
 
-			current_point += part_info.pointCount;
-			current_vertex += part_info.vertexCount;
-			current_face += part_info.faceCount;
+	// All SOPs are polled, even once a change is found, to reset their flag
+	for (int sid = 0; sid < hr->sop_count; ++sid) {
+		HAPI_GeoInfo geo_info;
+		H_CHECK_OR(HAPI_GetGeoInfo(&hr->hsession, hr->sop_array[sid], &geo_info)) {
+			changed = true;
+			continue;
+		}
+		// Parts are only available after an explicit cook in this case,
+		// see hruntime_consolidate_geo_counts
+		if (geo_info.hasGeoChanged || 0 == geo_info.partCount) {
+			changed = true;
 		}
 	}
+
+	return changed;
 }
 
-void hruntime_fill_vertex_attribute(HoudiniRuntime* hr, Attribute attr_data, const char* attr_name)
-{
+static const HoudiniPartLayout* output_cache_parts(const HoudiniOutputCache* cache) {
+	return (const HoudiniPartLayout*)(cache + 1);
+}
+
+const HoudiniOutputAttribute* hruntime_output_cache_attributes(const HoudiniOutputCache* cache) {
+	return (const HoudiniOutputAttribute*)(output_cache_parts(cache) + cache->part_count);
+}
+
+static const char* output_cache_data(const HoudiniOutputCache* cache) {
+	return (const char*)(hruntime_output_cache_attributes(cache) + cache->attribute_count);
+}
+
+static const int* output_cache_vertices(const HoudiniOutputCache* cache) {
+	return (const int*)(output_cache_data(cache) + 3 * sizeof(float) * cache->point_count);
+}
+
+const HoudiniOutputCache* hruntime_acquire_output_cache(HoudiniInstance* instance) {
+	return hcache_get(instance, HCACHE_OUTPUT_MESH, NULL);
+}
+
+void hruntime_release_output_cache(HoudiniInstance* instance) {
+	hcache_release(instance, HCACHE_OUTPUT_MESH);
+}
+
+bool hruntime_check_topology(HoudiniRuntime* hr, HoudiniInstance* instance, const HoudiniOutputCache* cache) {
 	HAPI_Result res;
-	HAPI_GeoInfo geo_info;
-	int current_vertex = 0;
+	int sample[MOD_HOUDINI_TOPOLOGY_SAMPLE_SIZE];
+
+	if (++instance->topology_check_count >= MOD_HOUDINI_TOPOLOGY_VERIFY_PERIOD) {
+		instance->topology_check_count = 0;
+		return false;
+	}
 
-	size_t minimum_stride = attr_data.componentCount * attributeTypeByteSize(attr_data.type);
-	bool is_contiguous = attr_data.stride == minimum_stride;
+	const HoudiniPartLayout* parts = output_cache_parts(cache);
+	const int* cached_vertices = output_cache_vertices(cache);
+	int part_index = 0;
+	size_t current_point = 0, current_vertex = 0;
+	hr->part_count = 0;
 
 	for (int sid = 0; sid < hr->sop_count; ++sid) {
+		HAPI_GeoInfo geo_info;
 		HAPI_NodeId node_id = hr->sop_array[sid];
 
-		H_CHECK_OR(HAPI_GetGeoInfo(&hr->hsession, node_id, &geo_info))
-			continue;
+		H_CHECK(HAPI_GetGeoInfo(&hr->hsession, node_id, &geo_info));
 
-		for (int i = 0; i < geo_info.partCount; ++i) {
+		for (int i = 0; i < geo_info.partCount; ++i, ++part_index) {
 			HAPI_PartInfo part_info;
-			HAPI_PartId part_id = (HAPI_PartId)i;
-
-			H_CHECK_OR(HAPI_GetPartInfo(&hr->hsession, node_id, part_id, &part_info))
-				continue;
+			H_CHECK(HAPI_GetPartInfo(&hr->hsession, node_id, (HAPI_PartId)i, &part_info));
 
-			if (part_info.type != HAPI_PARTTYPE_MESH) {
-				printf("Ignoring non-mesh part.\n");
-				continue;
+			if (part_index >= cache->part_count) {
+				return false;
 			}
-
-			HAPI_AttributeInfo attr_info;
-			H_CHECK_OR(HAPI_GetAttributeInfo(&hr->hsession, node_id, part_id, attr_name, HAPI_ATTROWNER_VERTEX, &attr_info))
-			{
-				current_vertex += part_info.vertexCount;
+			const HoudiniPartLayout* layout = &parts[part_index];
+			if (layout->type != part_info.type
+				|| layout->point_count != part_info.pointCount
+				|| layout->vertex_count != part_info.vertexCount
+				|| layout->face_count != part_info.faceCount
+				|| layout->instance_count != (HAPI_PARTTYPE_INSTANCER == part_info.type ? part_info.instanceCount : 0)) {
+				return false;
+			}
+			hruntime_push_part_layout(hr, &part_info);
+
+			// Instanced parts are compared as parts of their own, so only
+			// the position of the following parts matters here.
+			if (HAPI_PARTTYPE_INSTANCER == part_info.type) {
+				size_t part_point_count, part_vertex_count, part_face_count;
+				if (!hruntime_get_output_counts(hr, node_id, (HAPI_PartId)i, &part_info, &part_point_count, &part_vertex_count, &part_face_count)) {
+					return false;
+				}
+				current_point += part_point_count;
+				current_vertex += part_vertex_count;
 				continue;
 			}
 
-			if (!attr_info.exists)
-			{
-				current_vertex += part_info.vertexCount;
+			if (!is_output_mesh(&part_info)) {
 				continue;
 			}
 
-			// Get Point data
-			size_t houdini_stride = attr_info.tupleSize * storageByteSize(attr_info.storage);
-			bool can_raw_copy = is_contiguous && minimum_stride == houdini_stride;
-			char* part_data =
-				can_raw_copy
-				? attr_data.data + attr_data.stride * current_vertex
-				: malloc_array(houdini_stride, part_info.vertexCount, "houdini vertex attribute data");
-			H_CHECK_OR(HAPI_GetAttributeFloatData(&hr->hsession, node_id, part_id, attr_name, &attr_info, -1, (float*)part_data, 0, part_info.vertexCount))
-			{
-				if (!can_raw_copy) free_array(part_data);
-				continue;
+			if (current_vertex + part_info.vertexCount > (size_t)cache->vertex_count) {
+				return false;
 			}
 
-			if (!can_raw_copy)
-			{
-				// TODO: strided memcpy, can be vectorized
-				for (int i = 0; i < part_info.vertexCount; ++i) {
-					memcpy(
-						attr_data.data + attr_data.stride * (current_vertex + i),
-						part_data + houdini_stride * i,
-						min(minimum_stride, houdini_stride));
+			// Compare a window of the vertex list, moving from one cook to
+			// another so that the whole list eventually gets checked.
+			int length = min(MOD_HOUDINI_TOPOLOGY_SAMPLE_SIZE, part_info.vertexCount);
+			if (length > 0) {
+				int window_count = part_info.vertexCount / length;
+				int start = length * (instance->topology_check_count % window_count);
+				HSTATS_BYTES(0, sizeof(int) * length);
+				H_CHECK(HAPI_GetVertexList(&hr->hsession, node_id, (HAPI_PartId)i, sample, start, length));
+				for (int vid = 0; vid < length; ++vid) {
+					if ((int)current_point + sample[vid] != cached_vertices[current_vertex + start + vid]) {
+						return false;
+					}
 				}
-				free_array(part_data);
 			}
 
+			current_point += part_info.pointCount;
 			current_vertex += part_info.vertexCount;
 		}
 	}
+
+	return part_index == cache->part_count;
+}
+
+// private
+static size_t output_attribute_element_size(const HoudiniOutputAttribute* attr) {
+	return MOD_HOUDINI_COMPONENT_SIZE * attr->tuple_size;
+}
+
+// private
+static size_t output_attribute_element_count(const HoudiniOutputAttribute* attr, const HoudiniOutputCache* cache) {
+	return (size_t)hattrib_owner_element_count(attr->owner, cache->point_count, cache->vertex_count, cache->face_count);
+}
+
+// private
+static size_t host_element_size(Attribute attr) {
+	return attr.componentCount * attributeTypeByteSize(attr.type);
+}
+
+void hruntime_store_output(HoudiniRuntime* hr, HoudiniInstance* instance,
+	Attribute point_data, int point_count,
+	Attribute vertex_data, int vertex_count,
+	Attribute face_data, int face_count,
+	const Attribute* attr_data_array) {
+	size_t point_size = 3 * sizeof(float);
+	HoudiniOutputCache counts;
+	counts.point_count = point_count;
+	counts.vertex_count = vertex_count;
+	counts.face_count = face_count;
+
+	size_t size =
+		sizeof(HoudiniOutputCache)
+		+ sizeof(HoudiniPartLayout) * hr->part_count
+		+ sizeof(HoudiniOutputAttribute) * hr->output_attribute_count
+		+ point_size * point_count
+		+ sizeof(int) * vertex_count
+		+ sizeof(int) * face_count;
+	for (int a = 0; a < hr->output_attribute_count; ++a) {
+		const HoudiniOutputAttribute* attr = &hr->output_attribute_array[a];
+		size += output_attribute_element_size(attr) * output_attribute_element_count(attr, &counts);
+	}
+
+	HoudiniOutputCache* cache = hcache_put(instance, HCACHE_OUTPUT_MESH, size);
+	if (NULL == cache) {
+		// Does not fit in the budget, next cook will extract everything
+		hcache_drop(instance, HCACHE_OUTPUT_MESH);
+		return;
+	}
+
+	cache->point_count = point_count;
+	cache->vertex_count = vertex_count;
+	cache->face_count = face_count;
+	cache->attribute_count = hr->output_attribute_count;
+	cache->part_count = hr->part_count;
+
+	HoudiniPartLayout* parts = (HoudiniPartLayout*)(cache + 1);
+	memcpy(parts, hr->part_array, sizeof(HoudiniPartLayout) * hr->part_count);
+
+	HoudiniOutputAttribute* attributes = (HoudiniOutputAttribute*)(parts + hr->part_count);
+	memcpy(attributes, hr->output_attribute_array, sizeof(HoudiniOutputAttribute) * hr->output_attribute_count);
+
+	char* data = (char*)(attributes + hr->output_attribute_count);
+	copy_strided(data, point_size, point_data.data, point_data.stride, point_size, point_count);
+	data += point_size * point_count;
+	copy_strided(data, sizeof(int), vertex_data.data, vertex_data.stride, sizeof(int), vertex_count);
+	data += sizeof(int) * vertex_count;
+	copy_strided(data, sizeof(int), face_data.data, face_data.stride, sizeof(int), face_count);
+	data += sizeof(int) * face_count;
+	for (int a = 0; a < hr->output_attribute_count; ++a) {
+		const HoudiniOutputAttribute* attr = &hr->output_attribute_array[a];
+		Attribute attr_data = attr_data_array[a];
+		size_t element_size = output_attribute_element_size(attr);
+		size_t element_count = output_attribute_element_count(attr, cache);
+		if (NULL == attr_data.data) {
+			memset(data, 0, element_size * element_count);
+		} else {
+			zero_strided(data, element_size, element_size, element_count);
+			copy_strided(data, element_size, attr_data.data, attr_data.stride, min_size(element_size, host_element_size(attr_data)), element_count);
+		}
+		data += element_size * element_count;
+	}
+
+	hcache_release(instance, HCACHE_OUTPUT_MESH);
+}
+
+void hruntime_restore_topology(const HoudiniOutputCache* cache,
+	Attribute vertex_data,
+	Attribute face_data) {
+	const char* vertices = (const char*)output_cache_vertices(cache);
+	const char* faces = vertices + sizeof(int) * cache->vertex_count;
+	copy_strided(vertex_data.data, vertex_data.stride, vertices, sizeof(int), sizeof(int), cache->vertex_count);
+	copy_strided(face_data.data, face_data.stride, faces, sizeof(int), sizeof(int), cache->face_count);
+}
+
+void hruntime_restore_output(const HoudiniOutputCache* cache,
+	Attribute point_data,
+	Attribute vertex_data,
+	Attribute face_data,
+	const Attribute* attr_data_array) {
+	size_t point_size = 3 * sizeof(float);
+
+	copy_strided(point_data.data, point_data.stride, output_cache_data(cache), point_size, point_size, cache->point_count);
+	hruntime_restore_topology(cache, vertex_data, face_data);
+
+	const HoudiniOutputAttribute* attributes = hruntime_output_cache_attributes(cache);
+	const char* data = (const char*)(output_cache_vertices(cache) + cache->vertex_count + cache->face_count);
+	for (int a = 0; a < cache->attribute_count; ++a) {
+		Attribute attr_data = attr_data_array[a];
+		size_t element_size = output_attribute_element_size(&attributes[a]);
+		size_t element_count = output_attribute_element_count(&attributes[a], cache);
+		if (NULL != attr_data.data) {
+			copy_strided(attr_data.data, attr_data.stride, data, element_size, min_size(element_size, host_element_size(attr_data)), element_count);
+		}
+		data += element_size * element_count;
+	}
 }
 
 /**
  * For each of points, vertices and faces, Houdini's HAPI expects contiguous
  * arrays while Attribute variables contain strided arrays. In general, we
- * need to reallocate them, but when possible (ie. when already contiguous)
- * we use the raw pointer to avoid extra memory allocation.
+ * need to copy them into a staging buffer, but when possible (ie. when already
+ * contiguous) we use the raw pointer to avoid extra memory allocation.
+ *
+ * The staging buffer is retained in the houdini cache so that it is reused
+ * from one upload to the next, unless it does not fit in the cache budget in
+ * which case it is allocated for this call only.
  *
- * TODO: cache contiguous_data arrays?
  * TODO: parallelize this strided memcpy?
  *
  * @param count is the number of elements in the attribute
- * If the return value must_free is set to true, returned data has been newly
- * allocated and must hence be freed by the calling code.
+ * Returned data must be given back with releaseContiguousAttributeData()
+ * once the caller is done with it, passing the same must_free value.
  */
-static char* contiguousAttributeData(Attribute attr, int count, bool* must_free)
+static char* contiguousAttributeData(HoudiniRuntime* hr, Attribute attr, size_t count, bool* must_free)
 {
-	if (attr.type == MFX_UBYTE_ATTR)
+	size_t minimum_stride = attr.componentCount * attributeTypeByteSize(attr.type);
+	bool is_contiguous = attr.stride == minimum_stride;
+	if (is_contiguous && attr.type != MFX_UBYTE_ATTR)
 	{
-		// In this case we have to convert to int so we malloc anyway
 		*must_free = false;
-		int contiguous_stride = attr.componentCount * attributeTypeByteSize(MFX_FLOAT_ATTR);
-		char* contiguous_data = malloc_array(sizeof(char), contiguous_stride * count, "contiguous input data");
-		for (int i = 0; i < count; ++i) {
+		return attr.data;
+	}
+
+	// ubytes have to be converted to floats because houdini does not support them
+	size_t contiguous_stride =
+		attr.type == MFX_UBYTE_ATTR
+		? attr.componentCount * attributeTypeByteSize(MFX_FLOAT_ATTR)
+		: minimum_stride;
+
+	char* contiguous_data = hcache_put(hr, HCACHE_STAGING_BUFFER, contiguous_stride * count);
+	*must_free = NULL == contiguous_data;
+	if (*must_free) {
+		contiguous_data = malloc_array(sizeof(char), contiguous_stride * count, "contiguous input data");
+		if (NULL == contiguous_data) {
+			*must_free = false;
+			hr->is_out_of_memory = true;
+			return NULL;
+		}
+	}
+
+	if (attr.type == MFX_UBYTE_ATTR)
+	{
+		for (size_t i = 0; i < count; ++i) {
 			float* dst = (float*)(contiguous_data + contiguous_stride * i);
 			unsigned char* src = (unsigned char*)(attr.data + attr.stride * i);
 			for (int k = 0; k < attr.componentCount; ++k) {
 				dst[k] = (float)src[k]/255.0f;
 			}
 		}
-		return contiguous_data;
-	}
-
-	int minimum_stride = attr.componentCount * attributeTypeByteSize(attr.type);
-	bool is_contiguous = attr.stride == minimum_stride;
-	if (is_contiguous)
-	{
-		*must_free = false;
-		return attr.data;
 	}
 	else
 	{
-		*must_free = true;
-		char* contiguous_data = malloc_array(sizeof(char), minimum_stride * count, "contiguous input data");
-		for (int i = 0; i < count; ++i) {
-			memcpy(contiguous_data + minimum_stride * i, attr.data + attr.stride * i, minimum_stride);
-		}
-		return contiguous_data;
+		copy_strided(contiguous_data, minimum_stride, attr.data, attr.stride, minimum_stride, count);
+	}
+	return contiguous_data;
+}
+
+static void releaseContiguousAttributeData(HoudiniRuntime* hr, Attribute attr, char* data, bool must_free)
+{
+	if (must_free) {
+		free_array(data);
+	}
+	else if (NULL != data && data != attr.data) {
+		hcache_release(hr, HCACHE_STAGING_BUFFER);
+	}
+}
+
+void hruntime_get_input_label(HoudiniRuntime* hr, int input_index, char* label, int size) {
+	HAPI_Result res;
+	HAPI_StringHandle label_sh;
+	label[0] = '\0';
+	H_CHECK_OR(HAPI_GetNodeInputName(&hr->hsession, hr->node_id, input_index, &label_sh))
+		return;
+	H_CHECK_OR(HAPI_GetString(&hr->hsession, label_sh, label, size)) {
+		label[0] = '\0';
+	}
+}
+
+// private
+static uint64_t fingerprint_bytes(uint64_t fingerprint, const char* data, size_t size) {
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(uint64_t));
+		fingerprint = (fingerprint ^ word) * 1099511628211ull;
+		fingerprint ^= fingerprint >> 29;
+	}
+	for (; i < size; ++i) {
+		fingerprint = (fingerprint ^ (unsigned char)data[i]) * 1099511628211ull;
+	}
+	return fingerprint;
+}
+
+uint64_t hruntime_fingerprint_attribute(uint64_t fingerprint, Attribute attr, size_t count) {
+	fingerprint = fingerprint_bytes(fingerprint, (const char*)&count, sizeof(count));
+	if (NULL == attr.data) {
+		return fingerprint;
+	}
+	size_t element_size = attr.componentCount * attributeTypeByteSize(attr.type);
+	if (attr.stride == element_size) {
+		return fingerprint_bytes(fingerprint, attr.data, element_size * count);
+	}
+	for (size_t i = 0; i < count; ++i) {
+		fingerprint = fingerprint_bytes(fingerprint, attr.data + attr.stride * i, element_size);
 	}
+	return fingerprint;
+}
+
+bool hruntime_clear_input(HoudiniRuntime* hr, int input_index) {
+	HAPI_Result res;
+	HAPI_NodeId sop_id = hr->inputs[input_index].sop_id;
+
+	if (sop_id == -1) {
+		return true;
+	}
+
+	HAPI_PartInfo part_info = HAPI_PartInfo_Create();
+	part_info.pointCount = 0;
+	part_info.vertexCount = 0;
+	part_info.faceCount = 0;
+	part_info.isInstanced = false;
+	H_CHECK(HAPI_SetPartInfo(&hr->hsession, sop_id, 0, &part_info));
+	return hruntime_commit_geo(hr, input_index);
 }
 
 bool hruntime_feed_input_data(HoudiniRuntime* hr,
+	int input_index,
 	Attribute point_data, int point_count,
 	Attribute vertex_data, int vertex_count,
 	Attribute face_data, int face_count) {
 	HAPI_Result res;
+	HAPI_NodeId sop_id = hr->inputs[input_index].sop_id;
 
-	if (hr->input_sop_id == -1) {
+	if (sop_id == -1) {
 		return true;
 	}
 
@@ -684,7 +2837,7 @@ bool hruntime_feed_input_data(HoudiniRuntime* hr,
 	part_info.vertexCount = vertex_count;
 	part_info.faceCount = face_count;
 	part_info.isInstanced = false;
-	H_CHECK(HAPI_SetPartInfo(&hr->hsession, hr->input_sop_id, 0, &part_info));
+	H_CHECK(HAPI_SetPartInfo(&hr->hsession, sop_id, 0, &part_info));
 
 	HAPI_AttributeInfo attrib_info = HAPI_AttributeInfo_Create();
 	attrib_info.exists = true;
@@ -694,54 +2847,82 @@ bool hruntime_feed_input_data(HoudiniRuntime* hr,
 	attrib_info.storage = HAPI_STORAGETYPE_FLOAT;
 	attrib_info.typeInfo = HAPI_ATTRIBUTE_TYPE_POINT;
 
-	H_CHECK(HAPI_AddAttribute(&hr->hsession, hr->input_sop_id, 0, HAPI_ATTRIB_POSITION, &attrib_info));
+	H_CHECK(HAPI_AddAttribute(&hr->hsession, sop_id, 0, HAPI_ATTRIB_POSITION, &attrib_info));
 
 	bool must_free;
 
-	float* contiguous_point_data = (float*)contiguousAttributeData(point_data, point_count, &must_free);
-	H_CHECK(HAPI_SetAttributeFloatData(&hr->hsession, hr->input_sop_id, 0, HAPI_ATTRIB_POSITION, &attrib_info, contiguous_point_data, 0, point_count));
-	if (must_free) free_array(contiguous_point_data);
+	char* contiguous_point_data = contiguousAttributeData(hr, point_data, point_count, &must_free);
+	if (NULL == contiguous_point_data) return false;
+	if (!hruntime_set_attribute_data(hr, sop_id, 0, HAPI_ATTRIB_POSITION, &attrib_info, contiguous_point_data, point_count))
+	{
+		releaseContiguousAttributeData(hr, point_data, contiguous_point_data, must_free);
+		return false;
+	}
+	releaseContiguousAttributeData(hr, point_data, contiguous_point_data, must_free);
 
-	int* contiguous_vertex_data = (int*)contiguousAttributeData(vertex_data, vertex_count, &must_free);
-	H_CHECK(HAPI_SetVertexList(&hr->hsession, hr->input_sop_id, 0, contiguous_vertex_data, 0, vertex_count));
-	if (must_free) free_array(contiguous_vertex_data);
+	char* contiguous_vertex_data = contiguousAttributeData(hr, vertex_data, vertex_count, &must_free);
+	if (NULL == contiguous_vertex_data) return false;
+	if (!hruntime_set_vertex_list(hr, sop_id, 0, (int*)contiguous_vertex_data, vertex_count))
+	{
+		releaseContiguousAttributeData(hr, vertex_data, contiguous_vertex_data, must_free);
+		return false;
+	}
+	releaseContiguousAttributeData(hr, vertex_data, contiguous_vertex_data, must_free);
 
-	int* contiguous_face_data = (int*)contiguousAttributeData(face_data, face_count, &must_free);
-	H_CHECK(HAPI_SetFaceCounts(&hr->hsession, hr->input_sop_id, 0, contiguous_face_data, 0, face_count));
-	if (must_free) free_array(contiguous_face_data);
+	char* contiguous_face_data = contiguousAttributeData(hr, face_data, face_count, &must_free);
+	if (NULL == contiguous_face_data) return false;
+	if (!hruntime_set_face_counts(hr, sop_id, 0, (int*)contiguous_face_data, face_count))
+	{
+		releaseContiguousAttributeData(hr, face_data, contiguous_face_data, must_free);
+		return false;
+	}
+	releaseContiguousAttributeData(hr, face_data, contiguous_face_data, must_free);
 
 	return true;
 }
 
-bool hruntime_feed_vertex_attribute(
+bool hruntime_feed_attribute(
 	HoudiniRuntime* hr,
+	int input_index,
+	HAPI_AttributeOwner owner,
 	const char* attr_name,
-	Attribute attr_data, int vertex_count)
+	Attribute attr_data, int count)
 {
 	HAPI_Result res;
 	bool must_free;
+	HAPI_NodeId sop_id = hr->inputs[input_index].sop_id;
 
 	HAPI_AttributeInfo attrib_info = HAPI_AttributeInfo_Create();
 	attrib_info.exists = true;
-	attrib_info.owner = HAPI_ATTROWNER_VERTEX;
-	attrib_info.count = vertex_count;
+	attrib_info.owner = owner;
+	attrib_info.count = count;
 	attrib_info.tupleSize = attr_data.componentCount;
 	attrib_info.storage = attribute_type_to_houdini_storage(attr_data.type);
 	attrib_info.typeInfo = HAPI_ATTRIBUTE_TYPE_NONE;
 
-	H_CHECK(HAPI_AddAttribute(&hr->hsession, hr->input_sop_id, 0, attr_name, &attrib_info));
+	if (HAPI_STORAGETYPE_INVALID == attrib_info.storage) {
+		HLOG_WARNING(HLOG_GEO, "Input attribute %s has an unsupported type", attr_name);
+		return false;
+	}
+
+	H_CHECK(HAPI_AddAttribute(&hr->hsession, sop_id, 0, attr_name, &attrib_info));
 
-	float* contiguous_data = (float*)contiguousAttributeData(attr_data, vertex_count, &must_free);
-	H_CHECK(HAPI_SetAttributeFloatData(&hr->hsession, hr->input_sop_id, 0, attr_name, &attrib_info, contiguous_data, 0, vertex_count));
-	if (must_free) free_array(contiguous_data);
+	char* contiguous_data = contiguousAttributeData(hr, attr_data, count, &must_free);
+	if (NULL == contiguous_data) return false;
+	if (!hruntime_set_attribute_data(hr, sop_id, 0, attr_name, &attrib_info, contiguous_data, count))
+	{
+		releaseContiguousAttributeData(hr, attr_data, contiguous_data, must_free);
+		return false;
+	}
+	releaseContiguousAttributeData(hr, attr_data, contiguous_data, must_free);
 
 	return true;
 }
 
-bool hruntime_commit_geo(HoudiniRuntime* hr)
+bool hruntime_commit_geo(HoudiniRuntime* hr, int input_index)
 {
 	HAPI_Result res;
-	H_CHECK(HAPI_CommitGeo(&hr->hsession, hr->input_sop_id));
+	H_CHECK(HAPI_CommitGeo(&hr->hsession, hr->inputs[input_index].sop_id));
 	return true;
 }
 
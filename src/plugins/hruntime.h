@@ -18,46 +18,307 @@
 #define H_HRUNTIME
 
 #include "util/plugin_support.h" // for Attribute
+#include "houdini_utils.h"
+#include "hlibrary.h"
+#include "hattrib.h"
+#include "hinstancer.h"
 
 #include "HAPI/HAPI.h"
 
 #include <stdbool.h>
+#include <stdint.h>
+
+typedef struct Mutex Mutex;
+typedef struct Thread Thread;
+typedef struct HoudiniProfile HoudiniProfile;
+
+#define MOD_HOUDINI_DEFAULT_POOL_SIZE 2
+#define MOD_HOUDINI_DEFAULT_SESSION_LINGER 30 // seconds
+#define MOD_HOUDINI_DEFAULT_BOOT_TIMEOUT 120 // seconds
+// With threaded cooking, the cook state is polled at growing intervals
+// from MIN to MAX milliseconds while Houdini is busy.
+#define MOD_HOUDINI_COOK_POLL_MIN_MS 1
+#define MOD_HOUDINI_COOK_POLL_MAX_MS 16
+// Geometry inputs of SOP assets beyond this count are left unconnected
+#define MOD_HOUDINI_MAX_INPUTS 8
+// Display SOPs are listed again after this many cooks even if the node
+// looks unchanged, in case the display flag moved within the asset.
+#define MOD_HOUDINI_SOP_RECOMPOSE_PERIOD 64
+// When only positions change from one cook to another, the topology is
+// checked on a window of this many vertices per part, and fully verified
+// every MOD_HOUDINI_TOPOLOGY_VERIFY_PERIOD cooks.
+#define MOD_HOUDINI_TOPOLOGY_SAMPLE_SIZE 64
+#define MOD_HOUDINI_TOPOLOGY_VERIFY_PERIOD 32
+// Houdini Engine counts array sizes in int, so bulk transfers are split in
+// calls of at most this many bytes.
+#define MOD_HOUDINI_MAX_TRANSFER_BYTES ((size_t)1 << 30)
+// Attributes that cannot be downloaded right into host buffers are streamed
+// through a staging buffer of this size.
+#define MOD_HOUDINI_STAGING_BYTES ((size_t)1 << 22)
+
+/**
+ * A condition under which the asset is a no-op, so that the host can pass
+ * its input through without cooking. It is met when the OFX parameter named
+ * parm_name has the given values, up to MOD_HOUDINI_IDENTITY_EPSILON for
+ * float parameters.
+ */
+typedef struct HoudiniIdentityCondition {
+	char parm_name[MOD_HOUDINI_MAX_PARAMETER_NAME];
+	HAPI_ParmType type;
+	int size;
+	double values[4];
+} HoudiniIdentityCondition;
+
+/**
+ * An input node feeding one of the inputs of a SOP asset
+ */
+typedef struct HoudiniInputNode {
+	HAPI_NodeId node_id;
+	HAPI_NodeId sop_id; // receives the geometry sent by the host
+} HoudiniInputNode;
+
+/**
+ * An asset node, together with the input nodes feeding it for SOP assets.
+ * Only the first input_count inputs of the runtime are used.
+ */
+typedef struct HoudiniNode {
+	HAPI_NodeId node_id;
+	HoudiniInputNode inputs[MOD_HOUDINI_MAX_INPUTS];
+} HoudiniNode;
+
+/**
+ * Per instance data, attached to the mesh effect instance through
+ * kOfxPropInstanceData. The HoudiniRuntime is shared by all instances of a
+ * given asset so its node ids are bound to the instance being processed
+ * before each action.
+ */
+typedef struct HoudiniInstance {
+	HAPI_NodeId node_id;
+	HoudiniInputNode inputs[MOD_HOUDINI_MAX_INPUTS];
+	// Fingerprint of the geometry last sent to each input, 0 once emptied and
+	// HRUNTIME_FINGERPRINT_UNKNOWN when the node content is not known, see
+	// hruntime_fingerprint_attribute
+	uint64_t input_fingerprints[MOD_HOUDINI_MAX_INPUTS];
+	// True between kOfxActionBeginInstanceChanged and kOfxActionEndInstanceChanged
+	bool is_changing;
+	// One flag per parameter, set when the host reported a change not yet pushed
+	bool* dirty_parms_array;
+	// Display SOPs of the node, kept across cooks (see hruntime_fetch_sops)
+	int sop_count;
+	int sop_capacity;
+	HAPI_NodeId* sop_array;
+	int sop_child_count; // child count of the node when SOPs were listed, -1 if never
+	int sop_unique_id; // unique Houdini id of the node when SOPs were listed
+	int sop_check_count; // number of checks since SOPs were last listed
+	bool sops_changed; // whether the last listing changed the SOPs
+	int topology_check_count; // number of cheap topology checks since the last full extraction
+	// Nodes merging the display SOPs in merge mode, -1 if not created yet
+	HAPI_NodeId merge_geo_id;
+	HAPI_NodeId merge_input_id;
+	HAPI_NodeId merge_output_id;
+	// Whether the last cook ran out of time and the previous output was served
+	bool is_stale;
+	int cook_count; // number of cooks so far, used to pick the ones to profile
+	// Unlike node_id, which pooled nodes carry from one instance to another,
+	// this is never reused, so that profiles of different instances do not
+	// overwrite each other
+	int unique_id;
+} HoudiniInstance;
+
+/**
+ * Type and element counts of an output part, in the order in which parts
+ * are iterated, used to detect topology changes.
+ */
+typedef struct HoudiniPartLayout {
+	HAPI_PartType type;
+	int point_count;
+	int vertex_count;
+	int face_count;
+	int instance_count; // for instancer parts, 0 otherwise
+} HoudiniPartLayout;
+
+/**
+ * An output attribute found on at least one part, see
+ * hruntime_find_output_attributes. Its host type is int or float depending
+ * on its storage, and parts that do not have it get zeros.
+ */
+typedef struct HoudiniOutputAttribute {
+	int mapping_index; // in the attribute map of the runtime
+	HAPI_AttributeOwner owner;
+	HAPI_StorageType storage; // HAPI_STORAGETYPE_INT or HAPI_STORAGETYPE_FLOAT
+	int tuple_size; // largest among parts
+} HoudiniOutputAttribute;
+
+/**
+ * Copy of the last output extracted for an instance, retained in the cache
+ * with tag HCACHE_OUTPUT_MESH. The layout of the part_count parts, the
+ * description of the attribute_count output attributes, then point
+ * positions (3 floats), vertex points, face counts and the values of each
+ * attribute follow this header, tightly packed.
+ */
+typedef struct HoudiniOutputCache {
+	int point_count;
+	int vertex_count;
+	int face_count;
+	int attribute_count;
+	int part_count;
+} HoudiniOutputCache;
+
+/**
+ * Mirror of the int and float values of all the parameters of a node, used
+ * to only send values that actually changed, with one call per run of
+ * consecutive changed values. Int values, then float values, then one dirty
+ * flag per value (ints first) are stored right after this header.
+ */
+typedef struct HoudiniParmSnapshot {
+	int int_count;
+	int float_count;
+	// Ranges containing the dirty values, empty when min > max
+	int dirty_int_min, dirty_int_max;
+	int dirty_float_min, dirty_float_max;
+} HoudiniParmSnapshot;
 
 typedef struct HoudiniRuntime {
 	HAPI_Session hsession;
-	HAPI_AssetLibraryId library;
+	HoudiniLibrary* library; // shared with other runtimes using the same library
 	HAPI_NodeId node_id;
-	HAPI_NodeId input_node_id;
-	HAPI_NodeId input_sop_id;
-	HAPI_StringHandle* asset_names_array;
-	char current_library_path[1024];
+	HoudiniInputNode inputs[MOD_HOUDINI_MAX_INPUTS];
 	int current_asset_index;
 	int asset_count;
+	HAPI_NodeType asset_node_type; // HAPI_NODETYPE_NONE until the first node is built
+	int input_count; // geometry inputs of the asset, known with asset_node_type
+
+	// Warm pool of ready nodes, replenished in a background thread. Its size
+	// is read from MFX_HOUDINI_NODE_POOL_SIZE.
+	Mutex* pool_mutex;
+	Thread* pool_thread;
+	HoudiniNode* pool_array;
+	int pool_count;
+	int pool_size;
+	bool pool_replenishing;
+	bool pool_stopping;
+
+	// Whether display SOPs are merged into a single output, see MFX_HOUDINI_MERGE_PARTS
+	bool merge_parts;
+	// Whether normals are part of the default attribute map, see MFX_HOUDINI_NORMALS
+	bool transfer_normals;
+	// Used to cook the asset, so that packed primitives come as instancers
+	HAPI_CookOptions cook_options;
+	// Whether the session cooks in its own thread, which is required to
+	// interrupt cooks, see MFX_HOUDINI_COOK_BUDGET
+	bool threaded_cooking;
+	// Time a cook may take before it is interrupted, 0 for no limit
+	int cook_budget_ms;
+	// Whether the last call to hruntime_cook_asset was interrupted
+	bool cook_timed_out;
+	// Set when feeding an input failed to allocate a staging buffer, so that
+	// the host can be asked to free memory and retry
+	bool is_out_of_memory;
+	// Capture of the current cook, NULL if it is not profiled, see hprofile.h
+	HoudiniProfile* profile;
 
+	// Parameters are the same for all nodes of the asset, so they are only
+	// fetched once, see hruntime_fetch_parameters
+	bool has_parameters;
 	int parm_count;
 	HAPI_ParmInfo* parm_infos_array;
+	char* parm_names_array; // parm_count names of MOD_HOUDINI_MAX_PARAMETER_NAME chars
+	// Display SOPs of the bound instance, owned by the instance
 	int sop_count;
 	HAPI_NodeId* sop_array;
-	char* error_message;
+
+	// Layout of the output parts, as found by hruntime_consolidate_geo_counts
+	int part_count;
+	int part_capacity;
+	HoudiniPartLayout* part_array;
+	bool has_identity_conditions;
+	int identity_condition_count;
+	HoudiniIdentityCondition* identity_conditions_array;
+
+	// Attributes transferred besides positions and topology, see hattrib.h
+	bool has_attribute_map;
+	HoudiniAttributeMap attribute_map;
+	// Output attributes, as found by hruntime_find_output_attributes
+	int output_attribute_count;
+	HoudiniOutputAttribute* output_attribute_array; // one slot per mapping
+	char* error_message; // guarded by pool_mutex, since the pool thread may set it
+
+	// Startup statistics
+	double init_time_ms;
+	bool session_was_warm; // whether the session was still lingering at init
+	bool has_cooked;
 } HoudiniRuntime;
 
 
 void hruntime_set_error(HoudiniRuntime* hr, const char* fmt, ...);
 
+/**
+ * Start a HARS server listening on the given named pipe (ignored for in
+ * process sessions) and open an initialized session to it. With threaded
+ * cooking, node creations and cooks return before Houdini is done with them.
+ */
+bool hruntime_open_session(HAPI_Session* session, const char* pipe_name, bool threaded_cooking);
+
+void hruntime_close_session(HAPI_Session* session);
+
+/**
+ * Start opening the global session in a background thread, so that it is
+ * ready by the time a runtime needs it. Does nothing if already open.
+ */
+void hruntime_boot_session();
+
+/**
+ * Connect the runtime to the global session, opening it if needed. If the
+ * session is being started in the background, wait for it for at most
+ * MFX_HOUDINI_BOOT_TIMEOUT seconds, and fail if it does not come up.
+ */
 bool hruntime_init(HoudiniRuntime* hr);
 
+/**
+ * Disconnect the runtime from the global session. When it was the last
+ * user of the session, the session and the libraries loaded in it are kept
+ * for MFX_HOUDINI_SESSION_LINGER seconds before being closed, so that a
+ * new runtime created meanwhile does not restart Houdini.
+ */
 void hruntime_free(HoudiniRuntime* hr);
 
+/**
+ * Close the global session right away if it has no user and is lingering.
+ */
+void hruntime_flush_session();
+
+/**
+ * To be called after each successful cook, logs the time to first cook
+ */
+void hruntime_report_cook(HoudiniRuntime* hr);
+
+/**
+ * Select the library to use, through the library registry, or none if
+ * new_library_path is empty.
+ */
 void hruntime_set_library(HoudiniRuntime* hr, const char* new_library_path);
 
 /**
+ * Take a node from the warm pool, or build one if the pool is empty, and bind
+ * the runtime to it.
  * /pre hruntime_set_library_path has been called
  */
 void hruntime_create_node(HoudiniRuntime* hr);
 
+/**
+ * Give the bound node back to the pool after resetting its parameters to
+ * their defaults, or delete it if the pool is full.
+ */
 void hruntime_destroy_node(HoudiniRuntime* hr);
 
 /**
+ * Start filling the node pool in the background, if it is not full
+ */
+void hruntime_warm_pool(HoudiniRuntime* hr);
+
+/**
+ * Fetch the parameters of the current node. They are shared by all the nodes
+ * of the asset, so this only needs to run once, see has_parameters.
  * /pre hruntime_create_node has been called
  */
 void hruntime_fetch_parameters(HoudiniRuntime* hr);
@@ -67,48 +328,239 @@ void hruntime_fetch_parameters(HoudiniRuntime* hr);
  */
 void hruntime_get_parameter_name(HoudiniRuntime* hr, int parm_index, char* name);
 
+/**
+ * Return the index of the parameter called name, or -1 if there is none
+ * /pre hruntime_fetch_parameters has been called
+ */
+int hruntime_find_parameter(HoudiniRuntime* hr, const char* name);
+
+/**
+ * Bind the runtime to the nodes of an instance
+ */
+void hruntime_bind_instance(HoudiniRuntime* hr, const HoudiniInstance* instance);
+
+/**
+ * Allocate per instance data for the node that has just been created
+ * /pre hruntime_create_node and hruntime_fetch_parameters have been called
+ */
+HoudiniInstance* hruntime_new_instance(HoudiniRuntime* hr);
+
+/**
+ * /pre hruntime_destroy_node has been called
+ */
+void hruntime_free_instance(HoudiniRuntime* hr, HoudiniInstance* instance);
+
+/**
+ * Get the parameter snapshot of an instance from the cache, reading it from
+ * the node if it has been evicted. Return NULL if it does not fit in the cache.
+ * The snapshot must be given back with hruntime_commit_parm_snapshot().
+ */
+HoudiniParmSnapshot* hruntime_acquire_parm_snapshot(HoudiniRuntime* hr, const HoudiniInstance* instance);
+
+/**
+ * Update parameter values in the snapshot, without sending them yet
+ */
+void hruntime_stage_float_parm(HoudiniRuntime* hr, HoudiniParmSnapshot* snapshot, int parm_index, const float* values, int length);
+
+void hruntime_stage_int_parm(HoudiniRuntime* hr, HoudiniParmSnapshot* snapshot, int parm_index, const int* values, int length);
+
+/**
+ * Send staged values that differ from the node and release the snapshot
+ */
+void hruntime_commit_parm_snapshot(HoudiniRuntime* hr, const HoudiniInstance* instance, HoudiniParmSnapshot* snapshot);
+
+/**
+ * Gather the identity conditions declared by the asset, either through an
+ * "mfx_identity" tag on an mfx_ parameter (whose value lists the components
+ * for which the asset does nothing, e.g. "0") or through an "mfx_enable"
+ * toggle or int parameter, which is a no-op when set to 0.
+ * /pre hruntime_fetch_parameters has been called
+ */
+void hruntime_fetch_identity_conditions(HoudiniRuntime* hr);
+
+/**
+ * Load the attribute map of the asset from its MOD_HOUDINI_ATTRIBUTE_MAP_PARM
+ * parameter, or use HATTRIB_DEFAULT_MAP if it has none.
+ * /pre hruntime_fetch_parameters has been called
+ */
+void hruntime_fetch_attribute_map(HoudiniRuntime* hr);
+
+/**
+ * Read the cook budget of the asset from its MOD_HOUDINI_COOK_BUDGET_PARM
+ * parameter, if any, or from MFX_HOUDINI_COOK_BUDGET.
+ * /pre hruntime_fetch_parameters has been called
+ */
+void hruntime_fetch_cook_budget(HoudiniRuntime* hr);
+
 void hruntime_set_float_parm(HoudiniRuntime* hr, int parm_index, const float* values, int length);
 
 void hruntime_set_int_parm(HoudiniRuntime* hr, int parm_index, const int* values, int length);
 
+/**
+ * Cook the bound node. If it takes longer than hr->cook_budget_ms, the cook
+ * is interrupted, hr->cook_timed_out is set and this returns false. When
+ * hr->profile is set, the cook is recorded by the Houdini performance monitor.
+ */
 bool hruntime_cook_asset(HoudiniRuntime* hr);
 
-bool hruntime_fetch_sops(HoudiniRuntime* hr);
+/**
+ * Get the display SOPs of the instance into hr->sop_array. They are only
+ * listed again when the node info shows that the node changed. In merge
+ * mode, hr->sop_array rather contains the single node merging them.
+ * /pre hruntime_bind_instance(hr, instance) has been called
+ */
+bool hruntime_fetch_sops(HoudiniRuntime* hr, HoudiniInstance* instance);
 
+/**
+ * Sum the element counts of all mesh parts. Since OFX counts are int as
+ * well, parts that would make a count exceed INT_MAX are skipped with an
+ * error.
+ */
 void hruntime_consolidate_geo_counts(
     HoudiniRuntime* hr,
     int* point_count_ptr,
     int* vertex_count_ptr,
     int* face_count_ptr);
 
-bool hruntime_has_vertex_attribute(HoudiniRuntime* hr, const char* attr_name);
-
 void hruntime_fill_mesh(
     HoudiniRuntime* hr,
     Attribute point_data, int point_count,
     Attribute vertex_data, int vertex_count,
     Attribute face_data, int face_count);
 
-void hruntime_fill_vertex_attribute(
+/**
+ * Only download point positions, the output topology being the one of the
+ * previous cook (see hruntime_check_topology)
+ */
+void hruntime_fill_points(HoudiniRuntime* hr, Attribute point_data);
+
+/**
+ * List the output mappings of the attribute map whose Houdini attribute
+ * exists on at least one mesh part, into hr->output_attribute_array.
+ * Attribute names are queried once per part and owner.
+ * /pre hruntime_fetch_attribute_map has been called
+ */
+void hruntime_find_output_attributes(HoudiniRuntime* hr);
+
+/**
+ * Download the values of the output attributes into attr_data_array, which
+ * holds the host attribute matching each of hr->output_attribute_array.
+ * Vertex attributes that a part only has on points are expanded using
+ * vertex_data, the already filled output vertex list.
+ */
+void hruntime_fill_attributes(
     HoudiniRuntime* hr,
-    Attribute uv_data,
-    const char* attr_name);
+    const Attribute* attr_data_array,
+    Attribute vertex_data,
+    int point_count, int vertex_count, int face_count);
+
+/**
+ * Tell whether the output geometry of any display SOP changed since it was
+ * last queried, which is the case the first time after the SOPs are listed.
+ * Must be called right after cooking, before any other call to
+ * HAPI_GetGeoInfo since those reset the changed flag.
+ * /pre hruntime_fetch_sops(hr, instance) has been called
+ */
+bool hruntime_poll_geo_changes(HoudiniRuntime* hr, HoudiniInstance* instance);
+
+/**
+ * Return the output last stored for the instance, or NULL if there is none
+ * or it has been evicted. Must be balanced with hruntime_release_output_cache
+ */
+const HoudiniOutputCache* hruntime_acquire_output_cache(HoudiniInstance* instance);
+
+void hruntime_release_output_cache(HoudiniInstance* instance);
+
+/**
+ * Output attributes of a cached output, cache->attribute_count of them
+ */
+const HoudiniOutputAttribute* hruntime_output_cache_attributes(const HoudiniOutputCache* cache);
+
+/**
+ * Tell whether the topology of the output is the same as the one of the
+ * cached output, using part counts and a checksum of a sample of the vertex
+ * list. Return false periodically to force a full extraction.
+ * /pre hruntime_fetch_sops(hr, instance) has been called
+ */
+bool hruntime_check_topology(HoudiniRuntime* hr, HoudiniInstance* instance, const HoudiniOutputCache* cache);
+
+/**
+ * Keep a copy of the output mesh that has just been filled, if it fits in
+ * the cache budget. attr_data_array holds the values of the attributes of
+ * hr->output_attribute_array.
+ * /pre hruntime_consolidate_geo_counts has been called
+ */
+void hruntime_store_output(
+    HoudiniRuntime* hr,
+    HoudiniInstance* instance,
+    Attribute point_data, int point_count,
+    Attribute vertex_data, int vertex_count,
+    Attribute face_data, int face_count,
+    const Attribute* attr_data_array);
+
+/**
+ * Fill vertex points and face counts of an output mesh allocated with the
+ * counts of the cache
+ */
+void hruntime_restore_topology(
+    const HoudiniOutputCache* cache,
+    Attribute vertex_data,
+    Attribute face_data);
+
+/**
+ * Fill an output mesh allocated with the counts and attributes of the cache
+ */
+void hruntime_restore_output(
+    const HoudiniOutputCache* cache,
+    Attribute point_data,
+    Attribute vertex_data,
+    Attribute face_data,
+    const Attribute* attr_data_array);
+
+/**
+ * Name of the given input of the asset, as displayed in Houdini
+ * /pre hruntime_create_node has been called
+ */
+void hruntime_get_input_label(HoudiniRuntime* hr, int input_index, char* label, int size);
+
+/**
+ * Accumulate the count first elements of an attribute into a fingerprint,
+ * starting from HRUNTIME_FINGERPRINT_SEED, to detect inputs that did not
+ * change since they were last sent.
+ */
+#define HRUNTIME_FINGERPRINT_SEED 14695981039346656037ull
+// Input nodes of a new instance may come from the pool with the geometry of a
+// previous instance, and failed uploads leave them in an unknown state.
+#define HRUNTIME_FINGERPRINT_UNKNOWN UINT64_MAX
+uint64_t hruntime_fingerprint_attribute(uint64_t fingerprint, Attribute attr, size_t count);
+
+/**
+ * Empty an input whose host mesh is not available
+ */
+bool hruntime_clear_input(HoudiniRuntime* hr, int input_index);
 
 bool hruntime_feed_input_data(
     HoudiniRuntime* hr,
+    int input_index,
     Attribute point_data, int point_count,
     Attribute vertex_data, int vertex_count,
     Attribute face_data, int face_count);
 
-bool hruntime_feed_vertex_attribute(
+/**
+ * Send an attribute of an input mesh, count being the number of elements
+ * of the given owner.
+ */
+bool hruntime_feed_attribute(
     HoudiniRuntime* hr,
+    int input_index,
+    HAPI_AttributeOwner owner,
     const char *attr_name,
-    Attribute attr_data, int vertex_count);
+    Attribute attr_data, int count);
 
 /**
- * /post hruntime_feed_input_data will not longer be called, nor hruntime_feed_vertex_attribute
+ * /post hruntime_feed_input_data will not longer be called, nor hruntime_feed_attribute
  */
-bool hruntime_commit_geo(HoudiniRuntime* hr);
+bool hruntime_commit_geo(HoudiniRuntime* hr, int input_index);
 
 /**
  * If the returned message is not null, caller must free it itself
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hstats.h"
+
+#include "util/thread_util.h"
+#include "util/time_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HSTATS_MAX_FUNCTIONS 128
+#define HSTATS_MAX_NAME 64
+
+#if defined(_MSC_VER)
+#define HSTATS_THREAD_LOCAL __declspec(thread)
+#else
+#define HSTATS_THREAD_LOCAL __thread
+#endif
+
+typedef struct HoudiniCallStats {
+	int call_count;
+	int error_count;
+	double total_ms;
+	double max_ms;
+	size_t bytes_in;
+	size_t bytes_out;
+	int histogram[HSTATS_HISTOGRAM_SIZE];
+} HoudiniCallStats;
+
+typedef struct HoudiniStats {
+	Mutex* mutex;
+	int enabled; // -1 until the environment has been read
+	int function_count;
+	char names[HSTATS_MAX_FUNCTIONS][HSTATS_MAX_NAME];
+	HoudiniCallStats calls[HSTATS_SCOPE_COUNT][HSTATS_MAX_FUNCTIONS];
+} HoudiniStats;
+
+static HoudiniStats global_stats = { .mutex = NULL, .enabled = -1 };
+
+// Pending call of the current thread, HAPI calls are never nested
+static HSTATS_THREAD_LOCAL double current_start_ms = 0.0;
+static HSTATS_THREAD_LOCAL size_t current_bytes_in = 0;
+static HSTATS_THREAD_LOCAL size_t current_bytes_out = 0;
+
+void hstats_init(void) {
+	if (-1 != global_stats.enabled) {
+		return;
+	}
+	const char* env = getenv("MFX_HOUDINI_STATS");
+	if (NULL != env && 0 != atoi(env)) {
+		global_stats.mutex = mutex_create();
+		global_stats.enabled = 1;
+	} else {
+		global_stats.enabled = 0;
+	}
+}
+
+bool hstats_enabled(void) {
+	return 1 == global_stats.enabled;
+}
+
+void hstats_begin(void) {
+	if (!hstats_enabled()) {
+		return;
+	}
+	current_start_ms = time_now_ms();
+}
+
+void hstats_bytes(size_t bytes_in, size_t bytes_out) {
+	current_bytes_in = bytes_in;
+	current_bytes_out = bytes_out;
+}
+
+// private
+static int hstats_histogram_bucket(double ms) {
+	double us = ms * 1000.0;
+	int bucket = 0;
+	while (us >= 2.0 && bucket < HSTATS_HISTOGRAM_SIZE - 1) {
+		us /= 2.0;
+		++bucket;
+	}
+	return bucket;
+}
+
+/**
+ * Find or add the function called by call, which looks like
+ * "HAPI_Function(args...)".
+ * /pre stats are locked
+ */
+static int hstats_function_index(const char* call) {
+	size_t len = strcspn(call, "( ");
+	if (len >= HSTATS_MAX_NAME) {
+		len = HSTATS_MAX_NAME - 1;
+	}
+
+	for (int i = 0; i < global_stats.function_count; ++i) {
+		if (0 == strncmp(global_stats.names[i], call, len) && '\0' == global_stats.names[i][len]) {
+			return i;
+		}
+	}
+
+	if (global_stats.function_count == HSTATS_MAX_FUNCTIONS) {
+		return -1;
+	}
+
+	int index = global_stats.function_count++;
+	memcpy(global_stats.names[index], call, len);
+	global_stats.names[index][len] = '\0';
+	for (int scope = 0; scope < HSTATS_SCOPE_COUNT; ++scope) {
+		memset(&global_stats.calls[scope][index], 0, sizeof(HoudiniCallStats));
+	}
+	return index;
+}
+
+HAPI_Result hstats_end(const char* call, HAPI_Result res) {
+	if (!hstats_enabled()) {
+		return res;
+	}
+
+	double elapsed_ms = time_now_ms() - current_start_ms;
+	int bucket = hstats_histogram_bucket(elapsed_ms);
+
+	mutex_lock(global_stats.mutex);
+	int index = hstats_function_index(call);
+	if (-1 != index) {
+		for (int scope = 0; scope < HSTATS_SCOPE_COUNT; ++scope) {
+			HoudiniCallStats* stats = &global_stats.calls[scope][index];
+			stats->call_count++;
+			stats->error_count += HAPI_RESULT_SUCCESS != res ? 1 : 0;
+			stats->total_ms += elapsed_ms;
+			stats->max_ms = elapsed_ms > stats->max_ms ? elapsed_ms : stats->max_ms;
+			stats->bytes_in += current_bytes_in;
+			stats->bytes_out += current_bytes_out;
+			stats->histogram[bucket]++;
+		}
+	}
+	mutex_unlock(global_stats.mutex);
+
+	current_bytes_in = 0;
+	current_bytes_out = 0;
+	return res;
+}
+
+void hstats_dump(HoudiniStatsScope scope, const char* title) {
+	if (!hstats_enabled()) {
+		return;
+	}
+
+	mutex_lock(global_stats.mutex);
+
+	int total_calls = 0;
+	double total_ms = 0.0;
+	size_t total_in = 0, total_out = 0;
+	for (int i = 0; i < global_stats.function_count; ++i) {
+		const HoudiniCallStats* stats = &global_stats.calls[scope][i];
+		total_calls += stats->call_count;
+		total_ms += stats->total_ms;
+		total_in += stats->bytes_in;
+		total_out += stats->bytes_out;
+	}
+
+	printf("HAPI statistics (%s): %d calls, %.3f ms, %zu bytes sent, %zu bytes received\n",
+		title, total_calls, total_ms, total_in, total_out);
+
+	for (int i = 0; i < global_stats.function_count; ++i) {
+		HoudiniCallStats* stats = &global_stats.calls[scope][i];
+		if (0 == stats->call_count) {
+			continue;
+		}
+
+		printf("  %-40s %8d calls (%d failed) %10.3f ms total %8.3f ms avg %8.3f ms max",
+			global_stats.names[i], stats->call_count, stats->error_count,
+			stats->total_ms, stats->total_ms / stats->call_count, stats->max_ms);
+		if (0 != stats->bytes_in || 0 != stats->bytes_out) {
+			printf(" %zu B sent %zu B received", stats->bytes_in, stats->bytes_out);
+		}
+		printf("\n    latency (us, log2 buckets):");
+		for (int b = 0; b < HSTATS_HISTOGRAM_SIZE; ++b) {
+			if (0 != stats->histogram[b]) {
+				printf(" <%d:%d", 2 << b, stats->histogram[b]);
+			}
+		}
+		printf("\n");
+
+		memset(stats, 0, sizeof(HoudiniCallStats));
+	}
+
+	mutex_unlock(global_stats.mutex);
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Instrumentation of the calls to HAPI, to know how many round trips the
+ * plugin makes and how long they take. Every call going through H_CHECK,
+ * H_CHECK_OR or H_CHECK_LOG is counted per HAPI function, with its
+ * cumulated latency, a latency histogram and, for calls carrying mesh or
+ * parameter data, the number of bytes sent and received, which are declared
+ * with HSTATS_BYTES right before the call.
+ *
+ * Instrumentation is compiled in when MFX_HOUDINI_STATS is defined, and
+ * enabled at runtime by setting the MFX_HOUDINI_STATS environment variable
+ * to 1. Statistics are then printed after each cook and when the session
+ * is closed.
+ */
+
+#ifndef H_HSTATS
+#define H_HSTATS
+
+#include "HAPI/HAPI.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Latency buckets are powers of two of microseconds, the last one gathering
+// all slower calls.
+#define HSTATS_HISTOGRAM_SIZE 24
+
+typedef enum HoudiniStatsScope {
+	HSTATS_COOK, // reset after each cook
+	HSTATS_SESSION, // reset when the session is closed
+	HSTATS_SCOPE_COUNT,
+} HoudiniStatsScope;
+
+#ifdef MFX_HOUDINI_STATS
+
+#define H_CALL(op) (hstats_begin(), hstats_end(#op, (op)))
+#define HSTATS_BYTES(bytes_in, bytes_out) hstats_bytes((size_t)(bytes_in), (size_t)(bytes_out))
+
+#else // MFX_HOUDINI_STATS
+
+#define H_CALL(op) (op)
+#define HSTATS_BYTES(bytes_in, bytes_out)
+
+#endif // MFX_HOUDINI_STATS
+
+/**
+ * Read the settings from the environment, to be called once before any
+ * thread makes calls. Statistics are disabled until then.
+ */
+void hstats_init(void);
+
+bool hstats_enabled(void);
+
+/**
+ * Start timing a call on the current thread
+ */
+void hstats_begin(void);
+
+/**
+ * Declare the payload of the next call on the current thread
+ */
+void hstats_bytes(size_t bytes_in, size_t bytes_out);
+
+/**
+ * Record the call started with hstats_begin(). call is the text of the
+ * call, from which the function name is extracted. Return res.
+ */
+HAPI_Result hstats_end(const char* call, HAPI_Result res);
+
+/**
+ * Print statistics of a scope and reset them
+ */
+void hstats_dump(HoudiniStatsScope scope, const char* title);
+
+#endif // H_HSTATS
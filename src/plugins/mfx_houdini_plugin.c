@@ -24,6 +24,7 @@
 #include "ofxMeshEffect.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdarg.h>
@@ -35,6 +36,10 @@
 
 #include "houdini_utils.h"
 #include "hruntime.h"
+#include "hcache.h"
+#include "hlibrary.h"
+#include "hmanifest.h"
+#include "hprofile.h"
 
 // Houdini
 
@@ -42,13 +47,21 @@
 // Resources
 
 static char bundle_directory[MAX_BUNDLE_DIRECTORY];
+static HoudiniManifest manifest;
 
-const char * get_hda_path() {
-	static char path[MAX_BUNDLE_DIRECTORY];
-	size_t len = strlen(bundle_directory);
-	strcpy(path, bundle_directory);
-	strncpy(path + len, "\\library.hda", MAX_BUNDLE_DIRECTORY - len); // TODO: forward slash, resource folder
-	return path;
+/**
+ * Number of HAPI sessions used to load libraries at startup, from the
+ * MFX_HOUDINI_LOADER_SESSIONS environment variable.
+ */
+static int get_loader_session_count() {
+	const char* env = getenv("MFX_HOUDINI_LOADER_SESSIONS");
+	if (NULL != env) {
+		int count = atoi(env);
+		if (count > 0) {
+			return count;
+		}
+	}
+	return MOD_HOUDINI_DEFAULT_LOADER_SESSIONS;
 }
 
 // OFX
@@ -61,8 +74,10 @@ static OfxStatus plugin_load(PluginRuntime *runtime) {
 		return kOfxStatFailed;
 	}
 
-	hruntime_set_library(hr, get_hda_path());
-	hr->current_asset_index = runtime->pluginIndex;
+	// Only the library of this very plugin gets loaded
+	const HoudiniManifestEntry* entry = &manifest.entries[runtime->pluginIndex];
+	hruntime_set_library(hr, hmanifest_library_path(&manifest, entry->library_index));
+	hr->current_asset_index = entry->asset_index;
 	return kOfxStatOK;
 }
 
@@ -80,7 +95,7 @@ static void plugin_set_default_parameter(const PluginRuntime* runtime, OfxProper
 
 	if (info->size > 4)
 	{
-		printf("unsupported default value for parameter with dimension > 4");
+		HLOG_WARNING(HLOG_PARM, "unsupported default value for parameter with dimension > 4");
 		return;
 	}
 
@@ -91,6 +106,7 @@ static void plugin_set_default_parameter(const PluginRuntime* runtime, OfxProper
 	{
 		double dvalues[4];
 		float fvalues[4];
+		HSTATS_BYTES(0, sizeof(float) * info->size);
 		H_CHECK_OR(HAPI_GetParmFloatValues(&hr->hsession, hr->node_id, fvalues, info->floatValuesIndex, info->size)) {}
 		for (int i = 0; i < info->size; ++i) {
 			dvalues[i] = (double)fvalues[i];
@@ -99,8 +115,10 @@ static void plugin_set_default_parameter(const PluginRuntime* runtime, OfxProper
 		break;
 	}
 	case HAPI_PARMTYPE_INT:
+	case HAPI_PARMTYPE_TOGGLE:
 	{
 		int values[4];
+		HSTATS_BYTES(0, sizeof(int) * info->size);
 		H_CHECK_OR(HAPI_GetParmIntValues(&hr->hsession, hr->node_id, values, info->intValuesIndex, info->size)) {}
 		MFX_CHECK(propertySuite->propSetIntN(paramProps, kOfxParamPropDefault, info->size, values));
 		break;
@@ -108,6 +126,29 @@ static void plugin_set_default_parameter(const PluginRuntime* runtime, OfxProper
 	}
 }
 
+/**
+ * Whether an asset parameter is exposed to the host, which is the case of
+ * mfx_ parameters of a supported type, except the attribute map (see hattrib.h)
+ * and the cook budget.
+ */
+static bool plugin_is_exposed_parm(const char* name, const HAPI_ParmInfo* info) {
+	return NULL != houdini_to_ofx_type(info->type, info->size)
+		&& 0 == strncmp(name, "mfx_", 4)
+		&& 0 != strcmp(name, MOD_HOUDINI_ATTRIBUTE_MAP_PARM)
+		&& 0 != strcmp(name, MOD_HOUDINI_COOK_BUDGET_PARM);
+}
+
+/**
+ * OFX name of the input feeding the given input of the asset
+ */
+static const char* plugin_input_name(int input_index, char* buffer) {
+	if (0 == input_index) {
+		return kOfxMeshMainInput;
+	}
+	snprintf(buffer, MOD_HOUDINI_MAX_INPUT_NAME, MOD_HOUDINI_INPUT_NAME_FORMAT, input_index + 1);
+	return buffer;
+}
+
 static OfxStatus plugin_describe(const PluginRuntime *runtime, OfxMeshEffectHandle meshEffect) {
 	if (NULL == runtime->propertySuite || NULL == runtime->meshEffectSuite) {
 		return kOfxStatErrMissingHostFeature;
@@ -120,12 +161,29 @@ static OfxStatus plugin_describe(const PluginRuntime *runtime, OfxMeshEffectHand
 
 	MFX_CHECK(propertySuite->propSetString(propHandle, kOfxMeshEffectPropContext, 0, kOfxMeshEffectContextFilter));
 
+	HoudiniRuntime* hr = (HoudiniRuntime*)runtime->userData;
+	hruntime_create_node(hr);
+
 	// Shall move into "describe in context" when it will exist
+	// The main input is defined even for assets without inputs, since
+	// filters must have one.
 	OfxPropertySetHandle inputProperties;
 	MFX_CHECK(meshEffectSuite->inputDefine(meshEffect, kOfxMeshMainInput, &inputProperties));
 
 	MFX_CHECK(propertySuite->propSetString(inputProperties, kOfxPropLabel, 0, "Main Input"));
 
+	for (int i = 1; i < hr->input_count; ++i) {
+		char input_name[MOD_HOUDINI_MAX_INPUT_NAME];
+		char label[MOD_HOUDINI_MAX_INPUT_NAME];
+		hruntime_get_input_label(hr, i, label, MOD_HOUDINI_MAX_INPUT_NAME);
+		if ('\0' == label[0]) {
+			snprintf(label, MOD_HOUDINI_MAX_INPUT_NAME, "Input %d", i + 1);
+		}
+		HLOG_DEBUG(HLOG_GEO, "Defining input #%d: %s", i, label);
+		MFX_CHECK(meshEffectSuite->inputDefine(meshEffect, plugin_input_name(i, input_name), &inputProperties));
+		MFX_CHECK(propertySuite->propSetString(inputProperties, kOfxPropLabel, 0, label));
+	}
+
 	OfxPropertySetHandle outputProperties;
 	MFX_CHECK(meshEffectSuite->inputDefine(meshEffect, kOfxMeshMainOutput, &outputProperties)); // yes, output are also "inputs", I should change this name in the API
 	
@@ -137,8 +195,6 @@ static OfxStatus plugin_describe(const PluginRuntime *runtime, OfxMeshEffectHand
 	OfxPropertySetHandle paramProps;
 	MFX_CHECK(meshEffectSuite->getParamSet(meshEffect, &parameters));
 
-	HoudiniRuntime* hr = (HoudiniRuntime*)runtime->userData;
-	hruntime_create_node(hr);
 	hruntime_fetch_parameters(hr);
 	char name[MOD_HOUDINI_MAX_PARAMETER_NAME];
 	for (int i = 0 ; i < hr->parm_count ; ++i) {
@@ -147,12 +203,15 @@ static OfxStatus plugin_describe(const PluginRuntime *runtime, OfxMeshEffectHand
 		HAPI_ParmInfo info = hr->parm_infos_array[i];
 		const char *type = houdini_to_ofx_type(info.type, info.size);
 
-		if (NULL != type && 0 == strncmp(name, "mfx_", 4)) {
-			printf("Defining parameter %s\n", name);
+		if (plugin_is_exposed_parm(name, &info)) {
+			HLOG_DEBUG(HLOG_PARM, "Defining parameter %s", name);
 			MFX_CHECK(parameterSuite->paramDefine(parameters, type, name, &paramProps));
 			plugin_set_default_parameter(runtime, paramProps, &info);
 		}
 	}
+	hruntime_fetch_identity_conditions(hr);
+	hruntime_fetch_attribute_map(hr);
+	hruntime_fetch_cook_budget(hr);
 	hruntime_destroy_node(hr);
 
 	return kOfxStatOK;
@@ -162,18 +221,47 @@ static OfxStatus plugin_create_instance(const PluginRuntime *runtime, OfxMeshEff
 	HoudiniRuntime* hr = (HoudiniRuntime*)runtime->userData;
 	OfxPropertySetHandle propHandle;
 	hruntime_create_node(hr);
-	hruntime_fetch_parameters(hr);
+	if (!hr->has_parameters) {
+		hruntime_fetch_parameters(hr);
+	}
+	if (!hr->has_identity_conditions) {
+		hruntime_fetch_identity_conditions(hr);
+	}
+	if (!hr->has_attribute_map) {
+		hruntime_fetch_attribute_map(hr);
+		hruntime_fetch_cook_budget(hr);
+	}
+	HoudiniInstance* instance = hruntime_new_instance(hr);
+	hruntime_warm_pool(hr);
 	runtime->meshEffectSuite->getPropertySet(meshEffect, &propHandle);
 	runtime->propertySuite->propSetInt(propHandle, kOfxPropHoudiniNodeId, 0, hr->node_id);
+	runtime->propertySuite->propSetPointer(propHandle, kOfxPropInstanceData, 0, (void*)instance);
 	return kOfxStatOK;
 }
 
-static OfxStatus plugin_destroy_instance(const PluginRuntime *runtime, OfxMeshEffectHandle meshEffect) {
+/**
+ * Get the per instance data and bind the houdini runtime to its nodes
+ */
+static HoudiniInstance* plugin_bind_instance(const PluginRuntime *runtime, OfxMeshEffectHandle meshEffect) {
 	HoudiniRuntime* hr = (HoudiniRuntime*)runtime->userData;
 	OfxPropertySetHandle propHandle;
+	HoudiniInstance* instance = NULL;
 	runtime->meshEffectSuite->getPropertySet(meshEffect, &propHandle);
-	runtime->propertySuite->propGetInt(propHandle, kOfxPropHoudiniNodeId, 0, &hr->node_id);
+	runtime->propertySuite->propGetPointer(propHandle, kOfxPropInstanceData, 0, (void**)&instance);
+	if (NULL != instance) {
+		hruntime_bind_instance(hr, instance);
+	}
+	return instance;
+}
+
+static OfxStatus plugin_destroy_instance(const PluginRuntime *runtime, OfxMeshEffectHandle meshEffect) {
+	HoudiniRuntime* hr = (HoudiniRuntime*)runtime->userData;
+	HoudiniInstance* instance = plugin_bind_instance(runtime, meshEffect);
+	if (NULL == instance) {
+		return kOfxStatErrBadHandle;
+	}
 	hruntime_destroy_node(hr);
+	hruntime_free_instance(hr, instance);
 	return kOfxStatOK;
 }
 
@@ -184,7 +272,27 @@ static void copy_d4_to_f4(float float_values[4], double double_values[4]) {
 	float_values[3] = (float)double_values[3];
 }
 
-static bool plugin_get_parm_from_ofx(PluginRuntime *runtime, int parm_index, HAPI_ParmType type, int size, OfxParamHandle param) {
+static void plugin_set_int_parm(HoudiniRuntime* hr, HoudiniParmSnapshot *snapshot, int parm_index, const int* values, int length) {
+	if (NULL != snapshot) {
+		hruntime_stage_int_parm(hr, snapshot, parm_index, values, length);
+	} else {
+		hruntime_set_int_parm(hr, parm_index, values, length);
+	}
+}
+
+static void plugin_set_float_parm(HoudiniRuntime* hr, HoudiniParmSnapshot *snapshot, int parm_index, const float* values, int length) {
+	if (NULL != snapshot) {
+		hruntime_stage_float_parm(hr, snapshot, parm_index, values, length);
+	} else {
+		hruntime_set_float_parm(hr, parm_index, values, length);
+	}
+}
+
+/**
+ * Read a parameter value from ofx and stage it in the snapshot, or send it
+ * right away if there is no snapshot.
+ */
+static bool plugin_get_parm_from_ofx(PluginRuntime *runtime, HoudiniParmSnapshot *snapshot, int parm_index, HAPI_ParmType type, int size, OfxParamHandle param) {
 	OfxStatus status;
 	HoudiniRuntime* hr = (HoudiniRuntime*)runtime->userData;
 	double double_values[4];
@@ -207,7 +315,11 @@ static bool plugin_get_parm_from_ofx(PluginRuntime *runtime, int parm_index, HAP
 		default:
 			return false;
 		}
-		hruntime_set_int_parm(hr, parm_index, int_values, size);
+		plugin_set_int_parm(hr, snapshot, parm_index, int_values, size);
+		break;
+	case HAPI_PARMTYPE_TOGGLE:
+		MFX_CHECK(parameterSuite->paramGetValue(param, int_values+0));
+		plugin_set_int_parm(hr, snapshot, parm_index, int_values, 1);
 		break;
 	case HAPI_PARMTYPE_FLOAT:
 		switch (size) {
@@ -226,7 +338,7 @@ static bool plugin_get_parm_from_ofx(PluginRuntime *runtime, int parm_index, HAP
 			return false;
 		}
 		copy_d4_to_f4(float_values, double_values);
-		hruntime_set_float_parm(hr, parm_index, float_values, size);
+		plugin_set_float_parm(hr, snapshot, parm_index, float_values, size);
 		break;
 	case HAPI_PARMTYPE_COLOR:
 		switch (size) {
@@ -240,7 +352,7 @@ static bool plugin_get_parm_from_ofx(PluginRuntime *runtime, int parm_index, HAP
 			return false;
 		}
 		copy_d4_to_f4(float_values, double_values);
-		hruntime_set_float_parm(hr, parm_index, float_values, size);
+		plugin_set_float_parm(hr, snapshot, parm_index, float_values, size);
 		break;
 	case HAPI_PARMTYPE_STRING:
 		return false; // TODO
@@ -250,31 +362,211 @@ static bool plugin_get_parm_from_ofx(PluginRuntime *runtime, int parm_index, HAP
 	return true;
 }
 
-static OfxStatus plugin_cook(PluginRuntime *runtime, OfxMeshEffectHandle meshEffect) {
+/**
+ * Send mfx_ parameter values to the node of the currently bound instance.
+ * Only values that differ from what the node already has are sent, in at
+ * most one call per value type. If only_dirty is true, only parameters that
+ * the host reported as changed are read.
+ */
+static void plugin_push_parameters(PluginRuntime *runtime, OfxMeshEffectHandle meshEffect, HoudiniInstance *instance, bool only_dirty) {
 	OfxStatus status;
-	OfxMeshInputHandle input, output;
-	OfxPropertySetHandle propertySet, effectProperties;
 	HoudiniRuntime* hr = (HoudiniRuntime*)runtime->userData;
+	OfxParamSetHandle parameters;
+	OfxParamHandle param;
+	MFX_CHECK(meshEffectSuite->getParamSet(meshEffect, &parameters));
 
-	// Set node id in houdini runtime to match this mesh effect instance
-	MFX_CHECK(meshEffectSuite->getPropertySet(meshEffect, &effectProperties));
-	MFX_CHECK(propertySuite->propGetInt(effectProperties, kOfxPropHoudiniNodeId, 0, &hr->node_id));
+	HoudiniParmSnapshot* snapshot = hruntime_acquire_parm_snapshot(hr, instance);
 
-	MFX_CHECK(meshEffectSuite->inputGetHandle(meshEffect, kOfxMeshMainInput, &input, &propertySet));
-	if (status != kOfxStatOK) {
-		return kOfxStatErrUnknown;
+	char name[MOD_HOUDINI_MAX_PARAMETER_NAME];
+	for (int i = 0 ; i < hr->parm_count ; ++i) {
+		if (only_dirty && !instance->dirty_parms_array[i]) {
+			continue;
+		}
+		instance->dirty_parms_array[i] = false;
+
+		hruntime_get_parameter_name(hr, i, name);
+
+		HAPI_ParmInfo info = hr->parm_infos_array[i];
+
+		if (plugin_is_exposed_parm(name, &info)) {
+			runtime->parameterSuite->paramGetHandle(parameters, name, &param, NULL);
+			if (false == plugin_get_parm_from_ofx(runtime, snapshot, i, info.type, info.size, param)) {
+				HLOG_WARNING(HLOG_PARM, "Could not get value from ofx for parm #%d (%s) -- type = %d, size = %d", i, name, info.type, info.size);
+			}
+		}
 	}
 
-	MFX_CHECK(meshEffectSuite->inputGetHandle(meshEffect, kOfxMeshMainOutput, &output, &propertySet));
+	if (NULL != snapshot) {
+		hruntime_commit_parm_snapshot(hr, instance, snapshot);
+	}
+}
+
+static OfxStatus plugin_begin_instance_changed(PluginRuntime *runtime, OfxMeshEffectHandle meshEffect) {
+	HoudiniInstance* instance = plugin_bind_instance(runtime, meshEffect);
+	if (NULL == instance) {
+		return kOfxStatReplyDefault;
+	}
+	instance->is_changing = true;
+	return kOfxStatOK;
+}
+
+/**
+ * Mark the changed parameter as dirty. It is sent to Houdini when the change
+ * bracket ends, or right away if the host does not use brackets, rather than
+ * at the beginning of the next cook.
+ */
+static OfxStatus plugin_instance_changed(PluginRuntime *runtime, OfxMeshEffectHandle meshEffect, OfxPropertySetHandle inArgs) {
+	OfxStatus status;
+	HoudiniRuntime* hr = (HoudiniRuntime*)runtime->userData;
+	char *type, *name;
+
+	if (NULL == inArgs) {
+		return kOfxStatReplyDefault;
+	}
+
+	MFX_CHECK(propertySuite->propGetString(inArgs, kOfxPropType, 0, &type));
+	if (kOfxStatOK != status || 0 != strcmp(type, kOfxTypeParameter)) {
+		return kOfxStatReplyDefault;
+	}
+
+	MFX_CHECK(propertySuite->propGetString(inArgs, kOfxPropName, 0, &name));
+	if (kOfxStatOK != status || 0 != strncmp(name, "mfx_", 4)) {
+		return kOfxStatReplyDefault;
+	}
+
+	HoudiniInstance* instance = plugin_bind_instance(runtime, meshEffect);
+	int parm_index = hruntime_find_parameter(hr, name);
+	if (NULL == instance || -1 == parm_index) {
+		return kOfxStatReplyDefault;
+	}
+
+	instance->dirty_parms_array[parm_index] = true;
+	if (!instance->is_changing) {
+		plugin_push_parameters(runtime, meshEffect, instance, true /* only_dirty */);
+	}
+	return kOfxStatOK;
+}
+
+static OfxStatus plugin_end_instance_changed(PluginRuntime *runtime, OfxMeshEffectHandle meshEffect) {
+	HoudiniInstance* instance = plugin_bind_instance(runtime, meshEffect);
+	if (NULL == instance) {
+		return kOfxStatReplyDefault;
+	}
+	instance->is_changing = false;
+	plugin_push_parameters(runtime, meshEffect, instance, true /* only_dirty */);
+	return kOfxStatOK;
+}
+
+static bool plugin_is_identity_condition_met(PluginRuntime *runtime, OfxParamSetHandle parameters, const HoudiniIdentityCondition *cond) {
+	OfxStatus status;
+	OfxParamHandle param;
+	double double_values[4] = { 0.0, 0.0, 0.0, 0.0 };
+	int int_values[4] = { 0, 0, 0, 0 };
+
+	MFX_CHECK(parameterSuite->paramGetHandle(parameters, cond->parm_name, &param, NULL));
+	if (kOfxStatOK != status) {
+		return false;
+	}
+
+	switch (cond->type) {
+	case HAPI_PARMTYPE_INT:
+	case HAPI_PARMTYPE_TOGGLE:
+		MFX_CHECK(parameterSuite->paramGetValue(param, int_values+0, int_values+1, int_values+2, int_values+3));
+		for (int k = 0; k < cond->size; ++k) {
+			double_values[k] = (double)int_values[k];
+		}
+		break;
+	case HAPI_PARMTYPE_FLOAT:
+	case HAPI_PARMTYPE_COLOR:
+		MFX_CHECK(parameterSuite->paramGetValue(param, double_values+0, double_values+1, double_values+2, double_values+3));
+		break;
+	default:
+		return false;
+	}
+	if (kOfxStatOK != status) {
+		return false;
+	}
+
+	for (int k = 0; k < cond->size; ++k) {
+		if (HAPI_PARMTYPE_FLOAT == cond->type || HAPI_PARMTYPE_COLOR == cond->type) {
+			float diff = (float)double_values[k] - (float)cond->values[k];
+			if (diff > MOD_HOUDINI_IDENTITY_EPSILON || diff < -MOD_HOUDINI_IDENTITY_EPSILON) {
+				return false;
+			}
+		}
+		else if (double_values[k] != cond->values[k]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Tell the host to pass the main input through when one of the identity
+ * conditions declared by the asset is met. This only reads OFX parameters and
+ * never talks to Houdini, so that disabled effects cost nothing.
+ */
+static OfxStatus plugin_is_identity(PluginRuntime *runtime, OfxMeshEffectHandle meshEffect, OfxPropertySetHandle inArgs, OfxPropertySetHandle outArgs) {
+	OfxStatus status;
+	HoudiniRuntime* hr = (HoudiniRuntime*)runtime->userData;
+
+	if (0 == hr->identity_condition_count || NULL == outArgs) {
+		return kOfxStatReplyDefault;
+	}
+
+	OfxParamSetHandle parameters;
+	MFX_CHECK(meshEffectSuite->getParamSet(meshEffect, &parameters));
+	if (kOfxStatOK != status) {
+		return kOfxStatReplyDefault;
+	}
+
+	for (int i = 0; i < hr->identity_condition_count; ++i) {
+		const HoudiniIdentityCondition *cond = &hr->identity_conditions_array[i];
+		if (plugin_is_identity_condition_met(runtime, parameters, cond)) {
+			OfxTime time = 0;
+			if (NULL != inArgs) {
+				MFX_CHECK(propertySuite->propGetDouble(inArgs, kOfxPropTime, 0, &time));
+			}
+			MFX_CHECK(propertySuite->propSetString(outArgs, kOfxPropName, 0, kOfxMeshMainInput));
+			MFX_CHECK(propertySuite->propSetDouble(outArgs, kOfxPropTime, 0, time));
+			return kOfxStatOK;
+		}
+	}
+
+	return kOfxStatReplyDefault;
+}
+
+/**
+ * Send the mesh of an input to its input node, unless it is the same as the
+ * one sent at the previous cook of this instance. Inputs are compared using
+ * a fingerprint of everything that is sent.
+ */
+static OfxStatus plugin_feed_input(PluginRuntime *runtime, OfxMeshEffectHandle meshEffect, HoudiniInstance* instance, int input_index) {
+	OfxStatus status;
+	OfxMeshInputHandle input;
+	OfxPropertySetHandle propertySet;
+	HoudiniRuntime* hr = (HoudiniRuntime*)runtime->userData;
+	char input_name[MOD_HOUDINI_MAX_INPUT_NAME];
+
+	MFX_CHECK(meshEffectSuite->inputGetHandle(meshEffect, plugin_input_name(input_index, input_name), &input, &propertySet));
 	if (status != kOfxStatOK) {
-		return kOfxStatErrUnknown;
+		return status;
 	}
 
 	OfxTime time = 0;
 	OfxMeshHandle input_mesh;
 	OfxPropertySetHandle input_mesh_prop;
 	
-	MFX_CHECK(meshEffectSuite->inputGetMesh(input, time, &input_mesh, &input_mesh_prop));
+	status = runtime->meshEffectSuite->inputGetMesh(input, time, &input_mesh, &input_mesh_prop);
+	if (kOfxStatOK != status) {
+		// Not connected, the input is considered empty
+		HLOG_DEBUG(HLOG_GEO, "No mesh on input #%d (status %d)", input_index, status);
+		if (0 != instance->input_fingerprints[input_index]) {
+			bool cleared = hruntime_clear_input(hr, input_index);
+			instance->input_fingerprints[input_index] = cleared ? 0 : HRUNTIME_FINGERPRINT_UNKNOWN;
+		}
+		return kOfxStatErrMemory == status ? status : kOfxStatOK;
+	}
 
 	// Get input data
 	int input_point_count = 0, input_vertex_count = 0, input_face_count = 0;
@@ -287,48 +579,133 @@ static OfxStatus plugin_cook(PluginRuntime *runtime, OfxMeshEffectHandle meshEff
 	MFX_CHECK2(getVertexAttribute(runtime, input_mesh, kOfxMeshAttribVertexPoint, &input_vertpoint));
 	MFX_CHECK2(getFaceAttribute(runtime, input_mesh, kOfxMeshAttribFaceCounts, &input_facecounts));
 
-	printf("DEBUG: Found %d points in input mesh\n", input_point_count);
+	HLOG_DEBUG(HLOG_GEO, "Found %d points in input mesh #%d", input_point_count, input_index);
 
-	hruntime_feed_input_data(hr,
-		                     input_pos, input_point_count,
-		                     input_vertpoint, input_vertex_count,
-		                     input_facecounts, input_face_count);
-	
-	Attribute input_vertex_attr;
-	if (kOfxStatOK == getVertexAttribute(runtime, input_mesh, "color0", &input_vertex_attr)) {
-		hruntime_feed_vertex_attribute(hr, "Cd", input_vertex_attr, input_vertex_count);
+	uint64_t fingerprint = HRUNTIME_FINGERPRINT_SEED;
+	fingerprint = hruntime_fingerprint_attribute(fingerprint, input_pos, (size_t)input_point_count);
+	fingerprint = hruntime_fingerprint_attribute(fingerprint, input_vertpoint, (size_t)input_vertex_count);
+	fingerprint = hruntime_fingerprint_attribute(fingerprint, input_facecounts, (size_t)input_face_count);
+
+	// Attributes that the host does not provide are left out
+	Attribute* input_attr_array = NULL;
+	if (hr->attribute_map.count > 0) {
+		input_attr_array = malloc_array(sizeof(Attribute), hr->attribute_map.count, "input attributes");
+		if (NULL == input_attr_array) {
+			runtime->meshEffectSuite->inputReleaseMesh(input_mesh);
+			return kOfxStatErrMemory;
+		}
 	}
-	if (kOfxStatOK == getVertexAttribute(runtime, input_mesh, "uv0", &input_vertex_attr)) {
-		hruntime_feed_vertex_attribute(hr, "uv", input_vertex_attr, input_vertex_count);
+	for (int m = 0; m < hr->attribute_map.count; ++m) {
+		const HoudiniAttributeMapping* mapping = &hr->attribute_map.mappings[m];
+		if (HATTRIB_INPUT == mapping->direction
+			&& kOfxStatOK == getAttribute(runtime, input_mesh, hattrib_owner_attachment(mapping->owner), mapping->host_name, &input_attr_array[m])) {
+			int count = hattrib_owner_element_count(mapping->owner, input_point_count, input_vertex_count, input_face_count);
+			fingerprint = hruntime_fingerprint_attribute(fingerprint, input_attr_array[m], (size_t)count);
+		} else {
+			input_attr_array[m].data = NULL;
+		}
 	}
 
-	hruntime_commit_geo(hr);
+	bool is_out_of_memory = false;
+	if (fingerprint == instance->input_fingerprints[input_index]) {
+		HLOG_DEBUG(HLOG_GEO, "Input #%d did not change, not sending it again", input_index);
+	} else {
+		hr->is_out_of_memory = false;
+		bool success = hruntime_feed_input_data(hr, input_index,
+			                                    input_pos, input_point_count,
+			                                    input_vertpoint, input_vertex_count,
+			                                    input_facecounts, input_face_count);
+
+		for (int m = 0; m < hr->attribute_map.count && success; ++m) {
+			const HoudiniAttributeMapping* mapping = &hr->attribute_map.mappings[m];
+			if (NULL != input_attr_array[m].data) {
+				int count = hattrib_owner_element_count(mapping->owner, input_point_count, input_vertex_count, input_face_count);
+				success = hruntime_feed_attribute(hr, input_index, mapping->owner, mapping->houdini_name, input_attr_array[m], count);
+			}
+		}
+
+		success = success && hruntime_commit_geo(hr, input_index);
+		// Send the input again next time if anything went wrong
+		instance->input_fingerprints[input_index] = success ? fingerprint : HRUNTIME_FINGERPRINT_UNKNOWN;
+		is_out_of_memory = hr->is_out_of_memory;
+	}
+
+	if (NULL != input_attr_array) {
+		free_array(input_attr_array);
+	}
 
 	MFX_CHECK(meshEffectSuite->inputReleaseMesh(input_mesh));
+	return is_out_of_memory ? kOfxStatErrMemory : kOfxStatOK;
+}
 
-	// Get parameters
-	OfxParamSetHandle parameters;
-	OfxParamHandle param;
-	MFX_CHECK(meshEffectSuite->getParamSet(meshEffect, &parameters));
+static OfxStatus plugin_cook(PluginRuntime *runtime, OfxMeshEffectHandle meshEffect) {
+	OfxStatus status;
+	OfxMeshInputHandle output;
+	OfxPropertySetHandle propertySet;
+	HoudiniRuntime* hr = (HoudiniRuntime*)runtime->userData;
 
-	char name[MOD_HOUDINI_MAX_PARAMETER_NAME];
-	for (int i = 0 ; i < hr->parm_count ; ++i) {
-		hruntime_get_parameter_name(hr, i, name);
+	// Set node ids in houdini runtime to match this mesh effect instance
+	HoudiniInstance* instance = plugin_bind_instance(runtime, meshEffect);
+	if (NULL == instance) {
+		return kOfxStatErrBadHandle;
+	}
 
-		HAPI_ParmInfo info = hr->parm_infos_array[i];
-		const char *type = houdini_to_ofx_type(info.type, info.size);
+	MFX_CHECK(meshEffectSuite->inputGetHandle(meshEffect, kOfxMeshMainOutput, &output, &propertySet));
+	if (status != kOfxStatOK) {
+		return kOfxStatErrUnknown;
+	}
 
-		if (NULL != type && 0 == strncmp(name, "mfx_", 4)) {
-			runtime->parameterSuite->paramGetHandle(parameters, name, &param, NULL);
-			if (false == plugin_get_parm_from_ofx(runtime, i, info.type, info.size, param)) {
-				printf("Could not get value from ofx for parm #%d (%s) -- type = %d, size = %d\n", i, name, info.type, info.size);
-			}
+	OfxTime time = 0;
+	for (int i = 0; i < hr->input_count; ++i) {
+		status = plugin_feed_input(runtime, meshEffect, instance, i);
+		if (kOfxStatOK != status) {
+			// Out of memory is reported as such so that caches get purged
+			return kOfxStatErrMemory == status ? status : kOfxStatErrUnknown;
 		}
 	}
+	hprofile_stage(hr->profile, "inputs");
+
+	// Get parameters. When the host reports changes, they have usually been
+	// sent already and this sends nothing.
+	plugin_push_parameters(runtime, meshEffect, instance, false /* only_dirty */);
+	hprofile_stage(hr->profile, "parameters");
 
 	// Core cook
 
-	if (false == hruntime_cook_asset(hr)) {
+	bool geo_changed;
+	const HoudiniOutputCache* cache;
+	bool cooked = hruntime_cook_asset(hr);
+	hprofile_stage(hr->profile, "cook");
+	if (cooked) {
+		if (instance->is_stale) {
+			MFX_CHECK(messageSuite->clearPersistentMessage(meshEffect));
+			instance->is_stale = false;
+		}
+		if (false == hruntime_fetch_sops(hr, instance)) {
+			return kOfxStatErrUnknown;
+		}
+
+		// When the cook did not change the output, serve the previous one
+		// without downloading anything. When it changed but its topology did
+		// not (e.g. deformers), only download point positions and attributes.
+		geo_changed = hruntime_poll_geo_changes(hr, instance);
+		cache = hruntime_acquire_output_cache(instance);
+		if (NULL != cache && geo_changed && !hruntime_check_topology(hr, instance, cache)) {
+			hruntime_release_output_cache(instance);
+			cache = NULL;
+		}
+	} else if (hr->cook_timed_out && NULL != (cache = hruntime_acquire_output_cache(instance))) {
+		// The cook ran out of time, so rather than blocking the host, serve
+		// the last output that was fully extracted, if still cached.
+		geo_changed = false;
+		instance->is_stale = true;
+		MFX_CHECK(messageSuite->setPersistentMessage(meshEffect, kOfxMessageWarning, NULL,
+			"Houdini took more than %.1f s to cook, showing the previous result", 0.001 * hr->cook_budget_ms));
+	} else if (hr->cook_timed_out) {
+		MFX_CHECK(messageSuite->setPersistentMessage(meshEffect, kOfxMessageError, NULL,
+			"Houdini took more than %.1f s to cook and there is no previous result to show", 0.001 * hr->cook_budget_ms));
+		return kOfxStatErrUnknown;
+	} else {
 		char* message = hruntime_get_cook_error(hr);
 		if (NULL != message) {
 			MFX_CHECK(messageSuite->setPersistentMessage(meshEffect, kOfxMessageError, NULL, message));
@@ -336,9 +713,8 @@ static OfxStatus plugin_cook(PluginRuntime *runtime, OfxMeshEffectHandle meshEff
 		}
 		return kOfxStatErrUnknown;
 	}
-	if (false == hruntime_fetch_sops(hr)) {
-		return kOfxStatErrUnknown;
-	}
+
+	hprofile_stage(hr->profile, "changes");
 
 	OfxMeshHandle output_mesh;
 	OfxPropertySetHandle output_mesh_prop;
@@ -346,51 +722,159 @@ static OfxStatus plugin_cook(PluginRuntime *runtime, OfxMeshEffectHandle meshEff
 
 	// Consolidate geo counts
 	int output_point_count = 0, output_vertex_count = 0, output_face_count = 0;
-	hruntime_consolidate_geo_counts(hr,
-		                            &output_point_count,
-		                            &output_vertex_count,
-		                            &output_face_count);
+	const HoudiniOutputAttribute* output_attributes = hr->output_attribute_array;
+	int output_attribute_count;
+	if (NULL != cache) {
+		HLOG_DEBUG(HLOG_GEO, geo_changed ? "Output topology unchanged, only fetching positions." : "Output geometry unchanged, using cached output.");
+		output_point_count = cache->point_count;
+		output_vertex_count = cache->vertex_count;
+		output_face_count = cache->face_count;
+		if (geo_changed) {
+			hruntime_find_output_attributes(hr);
+		} else {
+			output_attributes = hruntime_output_cache_attributes(cache);
+		}
+	} else {
+		hruntime_consolidate_geo_counts(hr,
+			                            &output_point_count,
+			                            &output_vertex_count,
+			                            &output_face_count);
+		hruntime_find_output_attributes(hr);
+	}
+	output_attribute_count = NULL != cache && !geo_changed ? cache->attribute_count : hr->output_attribute_count;
 
-	printf("DEBUG: Allocating output mesh data: %d points, %d vertices, %d faces\n", output_point_count, output_vertex_count, output_face_count);
+	HLOG_DEBUG(HLOG_GEO, "Allocating output mesh data: %d points, %d vertices, %d faces", output_point_count, output_vertex_count, output_face_count);
 
 	MFX_CHECK(propertySuite->propSetInt(output_mesh_prop, kOfxMeshPropPointCount, 0, output_point_count));
 	MFX_CHECK(propertySuite->propSetInt(output_mesh_prop, kOfxMeshPropVertexCount, 0, output_vertex_count));
 	MFX_CHECK(propertySuite->propSetInt(output_mesh_prop, kOfxMeshPropFaceCount, 0, output_face_count));
 
 	// Declare output attributes
-	bool has_uv = hruntime_has_vertex_attribute(hr, "uv");
-	if (has_uv) {
-		OfxPropertySetHandle uv_attrib;
-		MFX_CHECK(meshEffectSuite->attributeDefine(output_mesh, kOfxMeshAttribVertex, "uv0", 2, kOfxMeshAttribTypeFloat, &uv_attrib));
+	for (int a = 0; a < output_attribute_count; ++a) {
+		const HoudiniOutputAttribute* attr = &output_attributes[a];
+		const HoudiniAttributeMapping* mapping = &hr->attribute_map.mappings[attr->mapping_index];
+		const char* type = HAPI_STORAGETYPE_INT == attr->storage ? kOfxMeshAttribTypeInt : kOfxMeshAttribTypeFloat;
+		OfxPropertySetHandle attrib;
+		MFX_CHECK(meshEffectSuite->attributeDefine(output_mesh, hattrib_owner_attachment(attr->owner), mapping->host_name, attr->tuple_size, type, &attrib));
 	}
 
 	MFX_CHECK(meshEffectSuite->meshAlloc(output_mesh));
+	if (kOfxStatErrMemory == status) {
+		if (NULL != cache) {
+			hruntime_release_output_cache(instance);
+		}
+		runtime->meshEffectSuite->inputReleaseMesh(output_mesh);
+		return kOfxStatErrMemory;
+	}
 
-	Attribute output_pos, output_vertpoint, output_facecounts, output_uv;
+	hprofile_stage(hr->profile, "allocation");
+
+	Attribute output_pos, output_vertpoint, output_facecounts;
 	MFX_CHECK2(getPointAttribute(runtime, output_mesh, kOfxMeshAttribPointPosition, &output_pos));
 	MFX_CHECK2(getVertexAttribute(runtime, output_mesh, kOfxMeshAttribVertexPoint, &output_vertpoint));
 	MFX_CHECK2(getFaceAttribute(runtime, output_mesh, kOfxMeshAttribFaceCounts, &output_facecounts));
 
+	// Attributes that the host failed to provide are left out
+	Attribute* output_attr_array = NULL;
+	if (output_attribute_count > 0) {
+		output_attr_array = malloc_array(sizeof(Attribute), output_attribute_count, "output attributes");
+	}
+	for (int a = 0; a < output_attribute_count; ++a) {
+		const HoudiniOutputAttribute* attr = &output_attributes[a];
+		const HoudiniAttributeMapping* mapping = &hr->attribute_map.mappings[attr->mapping_index];
+		MFX_CHECK2(getAttribute(runtime, output_mesh, hattrib_owner_attachment(attr->owner), mapping->host_name, &output_attr_array[a]));
+		if (kOfxStatOK != status) {
+			output_attr_array[a].data = NULL;
+		}
+	}
+
 	// Fill data
-	hruntime_fill_mesh(hr,
-		               output_pos, output_point_count,
-		               output_vertpoint, output_vertex_count,
-		               output_facecounts, output_face_count);
+	if (NULL != cache && !geo_changed) {
+		hruntime_restore_output(cache, output_pos, output_vertpoint, output_facecounts, output_attr_array);
+		hruntime_release_output_cache(instance);
+	} else {
+		if (NULL != cache) {
+			hruntime_restore_topology(cache, output_vertpoint, output_facecounts);
+			hruntime_release_output_cache(instance);
+			hruntime_fill_points(hr, output_pos);
+		} else {
+			hruntime_fill_mesh(hr,
+				               output_pos, output_point_count,
+				               output_vertpoint, output_vertex_count,
+				               output_facecounts, output_face_count);
+		}
 
-	if (has_uv) {
-		MFX_CHECK2(getVertexAttribute(runtime, output_mesh, "uv0", &output_uv));
-		hruntime_fill_vertex_attribute(hr, output_uv, "uv");
+		hruntime_fill_attributes(hr, output_attr_array, output_vertpoint,
+			                     output_point_count, output_vertex_count, output_face_count);
+
+		hruntime_store_output(hr, instance,
+			                  output_pos, output_point_count,
+			                  output_vertpoint, output_vertex_count,
+			                  output_facecounts, output_face_count,
+			                  output_attr_array);
 	}
 
+	if (NULL != output_attr_array) {
+		free_array(output_attr_array);
+	}
+	hprofile_stage(hr->profile, "extraction");
+
 	MFX_CHECK(meshEffectSuite->inputReleaseMesh(output_mesh));
+	hprofile_stage(hr->profile, "release");
 
+	hruntime_report_cook(hr);
 	return kOfxStatOK;
 }
 
-static PluginRuntime plugins[MAX_NUM_PLUGINS];
+/**
+ * Start timing the cook, and bind hr->profile to it if it gets captured
+ */
+static void plugin_begin_profile(PluginRuntime *runtime, OfxMeshEffectHandle meshEffect, OfxPropertySetHandle inArgs, HoudiniProfile *profile) {
+	HoudiniRuntime* hr = (HoudiniRuntime*)runtime->userData;
+	profile->active = false;
+	hr->profile = NULL;
+
+	if (!hprofile_enabled()) {
+		return;
+	}
+
+	HoudiniInstance* instance = plugin_bind_instance(runtime, meshEffect);
+	if (NULL == instance) {
+		return;
+	}
+
+	OfxTime frame = 0;
+	if (NULL != inArgs) {
+		runtime->propertySuite->propGetDouble(inArgs, kOfxPropTime, 0, &frame);
+	}
+	const char* asset_name = NULL != hr->library ? hlibrary_asset_name(hr->library, hr->current_asset_index) : NULL;
+	hprofile_begin(profile, asset_name, instance->unique_id, frame, instance->cook_count++);
+	if (profile->active) {
+		hr->profile = profile;
+	}
+}
+
+// One slot per exposed asset, allocated on first use by the host
+static PluginRuntime **plugins = NULL;
+static int plugin_count = 0;
+
+static PluginRuntime * get_plugin(int nth) {
+	if (nth < 0 || nth >= plugin_count) {
+		return NULL;
+	}
+	if (NULL == plugins[nth]) {
+		plugins[nth] = malloc_array(sizeof(PluginRuntime), 1, "plugin runtime");
+		memset(plugins[nth], 0, sizeof(PluginRuntime));
+		plugins[nth]->pluginIndex = nth;
+	}
+	return plugins[nth];
+}
 
 static void setHost(int nth, OfxHost *host) {
-	plugins[nth].host = host;
+	PluginRuntime *runtime = get_plugin(nth);
+	if (NULL != runtime) {
+		runtime->host = host;
+	}
 }
 
 static OfxStatus mainEntry(int nth,
@@ -398,35 +882,74 @@ static OfxStatus mainEntry(int nth,
 	                       const void *handle,
 	                       OfxPropertySetHandle inArgs,
 	                       OfxPropertySetHandle outArgs) {
+	PluginRuntime *runtime = get_plugin(nth);
+	if (NULL == runtime) {
+		return kOfxStatFailed;
+	}
 	if (0 == strcmp(action, kOfxActionLoad)) {
-		return plugin_load(&plugins[nth]);
+		return plugin_load(runtime);
 	}
 	if (0 == strcmp(action, kOfxActionUnload)) {
-		return plugin_unload(&plugins[nth]);
+		return plugin_unload(runtime);
 	}
 	if (0 == strcmp(action, kOfxActionDescribe)) {
-		return plugin_describe(&plugins[nth], (OfxMeshEffectHandle)handle);
+		return plugin_describe(runtime, (OfxMeshEffectHandle)handle);
 	}
 	if (0 == strcmp(action, kOfxActionCreateInstance)) {
-		return plugin_create_instance(&plugins[nth], (OfxMeshEffectHandle)handle);
+		return plugin_create_instance(runtime, (OfxMeshEffectHandle)handle);
 	}
 	if (0 == strcmp(action, kOfxActionDestroyInstance)) {
-		return plugin_destroy_instance(&plugins[nth], (OfxMeshEffectHandle)handle);
+		return plugin_destroy_instance(runtime, (OfxMeshEffectHandle)handle);
+	}
+	if (0 == strcmp(action, kOfxMeshEffectActionIsIdentity)) {
+		return plugin_is_identity(runtime, (OfxMeshEffectHandle)handle, inArgs, outArgs);
 	}
 	if (0 == strcmp(action, kOfxMeshEffectActionCook)) {
-		return plugin_cook(&plugins[nth], (OfxMeshEffectHandle)handle);
+		int cook = hlog_begin_cook();
+		HoudiniProfile profile;
+		plugin_begin_profile(runtime, (OfxMeshEffectHandle)handle, inArgs, &profile);
+		OfxStatus status = plugin_cook(runtime, (OfxMeshEffectHandle)handle);
+		if (kOfxStatErrMemory == status) {
+			HLOG_WARNING(HLOG_CACHE, "Out of memory while cooking, dropping Houdini caches and retrying.");
+			hcache_shrink(0);
+			status = plugin_cook(runtime, (OfxMeshEffectHandle)handle);
+		}
+		hprofile_end(&profile, kOfxStatOK == status);
+		((HoudiniRuntime*)runtime->userData)->profile = NULL;
+		if (kOfxStatOK != status) {
+			// Give context about the failure with the messages that were not printed
+			hlog_dump_cook(cook);
+		}
+		// Includes calls made since the previous cook, e.g. parameter changes
+		hstats_dump(HSTATS_COOK, "cook");
+		return status;
+	}
+	if (0 == strcmp(action, kOfxActionBeginInstanceChanged)) {
+		return plugin_begin_instance_changed(runtime, (OfxMeshEffectHandle)handle);
+	}
+	if (0 == strcmp(action, kOfxActionInstanceChanged)) {
+		return plugin_instance_changed(runtime, (OfxMeshEffectHandle)handle, inArgs);
+	}
+	if (0 == strcmp(action, kOfxActionEndInstanceChanged)) {
+		return plugin_end_instance_changed(runtime, (OfxMeshEffectHandle)handle);
+	}
+	if (0 == strcmp(action, kOfxActionPurgeCaches)) {
+		hcache_shrink(0);
+		return kOfxStatOK;
 	}
 	return kOfxStatReplyDefault;
 }
 
 // Closure mechanisme
-// to dynamically define OfxPlugin structs
+// to dynamically define OfxPlugin structs. The table of closures is
+// generated at build time with MAX_NUM_PLUGINS entries, see CMakeLists.txt.
 
 typedef void (OfxPluginSetHost)(OfxHost *host);
 
-static OfxPluginSetHost * setHost_pointers[MAX_NUM_PLUGINS];
-static OfxPluginEntryPoint * mainEntry_pointers[MAX_NUM_PLUGINS];
-static char pluginIdentifier_pointers[MAX_NUM_PLUGINS][MOD_HOUDINI_MAX_ASSET_NAME];
+typedef struct PluginClosure {
+	OfxPluginSetHost *setHost;
+	OfxPluginEntryPoint *mainEntry;
+} PluginClosure;
 
 #define MAKE_PLUGIN_CLOSURES(nth) \
 static void plugin ## nth ## _setHost(OfxHost *host) { \
@@ -439,38 +962,57 @@ static OfxStatus plugin ## nth ## _mainEntry(const char *action, \
 	return mainEntry(nth, action, handle, inArgs, outArgs); \
 }
 
-#define REGISTER_PLUGIN_CLOSURES(nth) \
-setHost_pointers[nth] = plugin ## nth ## _setHost; \
-mainEntry_pointers[nth] = plugin ## nth ## _mainEntry;
+#define PLUGIN_CLOSURE(nth) { plugin ## nth ## _setHost, plugin ## nth ## _mainEntry }
+
+// Defines plugin_closures[MAX_NUM_PLUGINS]
+#include "mfx_houdini_closures.h"
+
+#if defined(__GNUC__) && !defined(_WIN32)
+/**
+ * The session linger thread must not outlive the binary. NB: On Windows,
+ * threads cannot be joined while the library is being unloaded, so the
+ * session is only closed once its linger time is over.
+ */
+__attribute__((destructor))
+static void plugin_binary_unload() {
+	hruntime_flush_session();
+}
+#endif // __GNUC__ && !_WIN32
 
-MAKE_PLUGIN_CLOSURES(0)
-MAKE_PLUGIN_CLOSURES(1)
-MAKE_PLUGIN_CLOSURES(2)
-MAKE_PLUGIN_CLOSURES(3)
-MAKE_PLUGIN_CLOSURES(4)
-MAKE_PLUGIN_CLOSURES(5)
-MAKE_PLUGIN_CLOSURES(6)
-MAKE_PLUGIN_CLOSURES(7)
-MAKE_PLUGIN_CLOSURES(8)
-MAKE_PLUGIN_CLOSURES(9)
-// MAX_NUM_PLUGINS
+/**
+ * Create the global state shared by the threads of the plugin. This is
+ * called from the first entry points, before any of these threads starts.
+ */
+static void plugin_init_globals() {
+	static bool is_initialized = false;
+	if (is_initialized) {
+		return;
+	}
+	hlog_init();
+	hstats_init();
+	hprofile_init();
+	hlibrary_init();
+	hcache_init();
+	is_initialized = true;
+}
 
 OfxExport void OfxSetBundleDirectory(const char *path) {
+	plugin_init_globals();
 	strncpy(bundle_directory, path, MAX_BUNDLE_DIRECTORY);
+
+	// Houdini takes a while to start, let it do so while the host keeps
+	// loading. It is joined by the first call that needs it.
+	hruntime_boot_session();
 }
 
 OfxExport int OfxGetNumberOfPlugins(void) {
-	REGISTER_PLUGIN_CLOSURES(0)
-	REGISTER_PLUGIN_CLOSURES(1)
-	REGISTER_PLUGIN_CLOSURES(2)
-	REGISTER_PLUGIN_CLOSURES(3)
-	REGISTER_PLUGIN_CLOSURES(4)
-	REGISTER_PLUGIN_CLOSURES(5)
-	REGISTER_PLUGIN_CLOSURES(6)
-	REGISTER_PLUGIN_CLOSURES(7)
-	REGISTER_PLUGIN_CLOSURES(8)
-	REGISTER_PLUGIN_CLOSURES(9)
-	// MAX_NUM_PLUGINS
+	plugin_init_globals();
+
+	// Plugins handed to the host must remain valid, so libraries are only
+	// listed once per process.
+	if (NULL != plugins) {
+		return plugin_count;
+	}
 
 	int num_plugins;
 	HoudiniRuntime *hr = malloc_array(sizeof(HoudiniRuntime), 1, "houdini runtime");
@@ -478,32 +1020,42 @@ OfxExport int OfxGetNumberOfPlugins(void) {
 		return 0;
 	}
 
-	hruntime_set_library(hr, get_hda_path());
-	num_plugins = hr->asset_count;
-
-	for (int i = 0 ; i < num_plugins ; ++i) {
-		HAPI_Result res;
-		res = HAPI_GetString(&hr->hsession, hr->asset_names_array[i], pluginIdentifier_pointers[i], MOD_HOUDINI_MAX_ASSET_NAME);
-		if (HAPI_RESULT_SUCCESS != res) {
-			ERR("Houdini error in HAPI_GetString: %u\n", res);
-		}
+	hmanifest_free(&manifest);
+	hmanifest_scan(&manifest, bundle_directory);
+	hmanifest_load(&manifest, &hr->hsession, get_loader_session_count());
+	num_plugins = manifest.entry_count;
 
-		OfxPlugin *plugin = &plugins[i].plugin;
-		plugin->pluginApi = kOfxMeshEffectPluginApi;
-		plugin->apiVersion = kOfxMeshEffectPluginApiVersion;
-		plugin->pluginIdentifier = pluginIdentifier_pointers[i];
-		plugin->pluginVersionMajor = 1;
-		plugin->pluginVersionMinor = 0;
-		plugin->setHost = setHost_pointers[i];
-		plugin->mainEntry = mainEntry_pointers[i];
+	if (num_plugins > MAX_NUM_PLUGINS) {
+		HLOG_WARNING(HLOG_SESSION, "Only the first %d of the %d Houdini assets are exposed, "
+		             "build with a larger MFX_HOUDINI_MAX_PLUGINS to expose all of them", MAX_NUM_PLUGINS, num_plugins);
+		num_plugins = MAX_NUM_PLUGINS;
+	}
 
-		plugins[i].pluginIndex = i;
+	plugin_count = num_plugins;
+	if (plugin_count > 0) {
+		plugins = malloc_array(sizeof(PluginRuntime*), plugin_count, "plugin runtimes");
+		for (int i = 0 ; i < plugin_count ; ++i) {
+			plugins[i] = NULL;
+		}
 	}
 
 	hruntime_free(hr);
-	return min(num_plugins, MAX_NUM_PLUGINS);
+	return plugin_count;
 }
 
 OfxExport OfxPlugin *OfxGetPlugin(int nth) {
-	return &plugins[nth].plugin;
+	PluginRuntime *runtime = get_plugin(nth);
+	if (NULL == runtime) {
+		return NULL;
+	}
+
+	OfxPlugin *plugin = &runtime->plugin;
+	plugin->pluginApi = kOfxMeshEffectPluginApi;
+	plugin->apiVersion = kOfxMeshEffectPluginApiVersion;
+	plugin->pluginIdentifier = manifest.entries[nth].asset_name;
+	plugin->pluginVersionMajor = 1;
+	plugin->pluginVersionMinor = 0;
+	plugin->setHost = plugin_closures[nth].setHost;
+	plugin->mainEntry = plugin_closures[nth].mainEntry;
+	return plugin;
 }
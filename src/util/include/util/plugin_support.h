@@ -48,7 +48,7 @@ enum AttributeType {
 
 typedef struct Attribute {
   enum AttributeType type;
-  int stride;
+  size_t stride; // in bytes
   int componentCount;
   char *data;
 } Attribute;
@@ -82,6 +82,6 @@ OfxStatus getFaceAttribute(PluginRuntime* runtime, OfxMeshHandle mesh, const cha
  * Copy attribute and try to cast. If number of component is different, copy the common components
  * only.
  */
-OfxStatus copyAttribute(Attribute *destination, const Attribute *source, int start, int count);
+OfxStatus copyAttribute(Attribute *destination, const Attribute *source, size_t start, size_t count);
 
 #endif // __MFX_PLUGIN_SUPPORT_H__
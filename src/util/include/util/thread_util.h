@@ -0,0 +1,83 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** \file
+ * \ingroup openmesheffect
+ *
+ * Thread Utils - minimal portable wrappers around win32 and pthread
+ *
+ */
+
+#ifndef __MFX_THREAD_UTIL_H__
+#define __MFX_THREAD_UTIL_H__
+
+typedef struct Mutex Mutex;
+typedef struct Thread Thread;
+typedef struct Condition Condition;
+
+typedef void (ThreadFunction)(void *arg);
+
+/**
+ * Create a new (non recursive) mutex, to be released with mutex_free()
+ */
+Mutex * mutex_create(void);
+void mutex_free(Mutex *mutex);
+void mutex_lock(Mutex *mutex);
+void mutex_unlock(Mutex *mutex);
+
+/**
+ * Condition variable, to be used together with a mutex and released with
+ * condition_free()
+ */
+Condition * condition_create(void);
+void condition_free(Condition *cond);
+
+/**
+ * Atomically unlock mutex and wait until the condition is signaled or
+ * timeout_ms milliseconds elapsed (forever if negative). The mutex is locked
+ * again when returning. Like with any condition variable, wake ups may be
+ * spurious so the caller must check its predicate again.
+ */
+void condition_wait(Condition *cond, Mutex *mutex, int timeout_ms);
+
+/**
+ * Wake up all threads waiting on the condition
+ */
+void condition_broadcast(Condition *cond);
+
+/**
+ * Atomically increment value and return its new value. This is a full
+ * memory barrier.
+ */
+int interlocked_increment(volatile int *value);
+
+/**
+ * Full memory barrier, for lock-free structures
+ */
+void memory_barrier(void);
+
+/**
+ * Run func(arg) in a new thread, that must eventually be joined with
+ * thread_join(). Return NULL if the thread could not be started.
+ */
+Thread * thread_start(ThreadFunction *func, void *arg);
+
+/**
+ * Wait for the thread to finish and release it
+ */
+void thread_join(Thread *thread);
+
+#endif // __MFX_THREAD_UTIL_H__
@@ -0,0 +1,31 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __MFX_TIME_UTIL_H__
+#define __MFX_TIME_UTIL_H__
+
+/**
+ * Monotonic time in milliseconds, with sub-millisecond precision, from an
+ * arbitrary origin. Only differences between two calls are meaningful.
+ */
+double time_now_ms(void);
+
+/**
+ * Suspend the calling thread for at least ms milliseconds
+ */
+void time_sleep_ms(int ms);
+
+#endif // __MFX_TIME_UTIL_H__
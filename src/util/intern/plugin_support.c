@@ -68,12 +68,14 @@ OfxStatus getAttribute(PluginRuntime* runtime, OfxMeshHandle mesh, const char *a
 
   OfxPropertySetHandle attr_props;
   char *type;
+  int stride;
   MFX_ENSURE(meshEffectSuite->meshGetAttribute(mesh, attachment, name, &attr_props));
   MFX_ENSURE(propertySuite->propGetString(attr_props, kOfxMeshAttribPropType, 0, &type));
-  MFX_ENSURE(propertySuite->propGetInt(attr_props, kOfxMeshAttribPropStride, 0, &attr->stride));
+  MFX_ENSURE(propertySuite->propGetInt(attr_props, kOfxMeshAttribPropStride, 0, &stride));
   MFX_ENSURE(propertySuite->propGetInt(attr_props, kOfxMeshAttribPropComponentCount, 0, &attr->componentCount));
   MFX_ENSURE(propertySuite->propGetPointer(attr_props, kOfxMeshAttribPropData, 0, (void**)&attr->data));
   attr->type = mfxAttrAsEnum(type);
+  attr->stride = (size_t)stride;
 
   return kOfxStatOK;
 }
@@ -93,7 +95,7 @@ OfxStatus getFaceAttribute(PluginRuntime* runtime, OfxMeshHandle mesh, const cha
   return getAttribute(runtime, mesh, kOfxMeshAttribFace, name, attr);
 }
 
-OfxStatus copyAttribute(Attribute *destination, const Attribute *source, int start, int count)
+OfxStatus copyAttribute(Attribute *destination, const Attribute *source, size_t start, size_t count)
 {
   int componentCount = source->componentCount < destination->componentCount ? source->componentCount : destination->componentCount;
 
@@ -116,7 +118,7 @@ OfxStatus copyAttribute(Attribute *destination, const Attribute *source, int sta
       return kOfxStatErrFatal;
     }
 
-    for (int i = 0; i < count; ++i) {
+    for (size_t i = 0; i < count; ++i) {
       const void *src = (void*)&source->data[(start + i) * source->stride];
       void *dst = (void*)&destination->data[(start + i) * destination->stride];
       memcpy(dst, src, componentCount * componentByteSize);
@@ -128,7 +130,7 @@ OfxStatus copyAttribute(Attribute *destination, const Attribute *source, int sta
   case MFX_FLOAT_ATTR:
     switch (source->type) {
     case MFX_UBYTE_ATTR:
-      for (int i = 0; i < count; ++i) {
+      for (size_t i = 0; i < count; ++i) {
         const unsigned char *src = (unsigned char *)&source->data[(start + i) * source->stride];
         float *dst = (float*)&destination->data[(start + i) * destination->stride];
         for (int k = 0; k < componentCount; ++k)
@@ -0,0 +1,199 @@
+/*
+ * Copyright 2019 - 2020 Elie Michel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "thread_util.h"
+#include "memory_util.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else // _WIN32
+#include <pthread.h>
+#include <time.h>
+#endif // _WIN32
+
+struct Thread {
+#ifdef _WIN32
+  HANDLE handle;
+#else // _WIN32
+  pthread_t handle;
+#endif // _WIN32
+  ThreadFunction *func;
+  void *arg;
+};
+
+struct Mutex {
+#ifdef _WIN32
+  CRITICAL_SECTION handle;
+#else // _WIN32
+  pthread_mutex_t handle;
+#endif // _WIN32
+};
+
+Mutex * mutex_create(void) {
+  Mutex *mutex = malloc_array(sizeof(Mutex), 1, "mutex");
+  if (NULL == mutex) {
+    return NULL;
+  }
+#ifdef _WIN32
+  InitializeCriticalSection(&mutex->handle);
+#else // _WIN32
+  pthread_mutex_init(&mutex->handle, NULL);
+#endif // _WIN32
+  return mutex;
+}
+
+void mutex_free(Mutex *mutex) {
+#ifdef _WIN32
+  DeleteCriticalSection(&mutex->handle);
+#else // _WIN32
+  pthread_mutex_destroy(&mutex->handle);
+#endif // _WIN32
+  free_array(mutex);
+}
+
+void mutex_lock(Mutex *mutex) {
+#ifdef _WIN32
+  EnterCriticalSection(&mutex->handle);
+#else // _WIN32
+  pthread_mutex_lock(&mutex->handle);
+#endif // _WIN32
+}
+
+void mutex_unlock(Mutex *mutex) {
+#ifdef _WIN32
+  LeaveCriticalSection(&mutex->handle);
+#else // _WIN32
+  pthread_mutex_unlock(&mutex->handle);
+#endif // _WIN32
+}
+
+struct Condition {
+#ifdef _WIN32
+  CONDITION_VARIABLE handle;
+#else // _WIN32
+  pthread_cond_t handle;
+#endif // _WIN32
+};
+
+Condition * condition_create(void) {
+  Condition *cond = malloc_array(sizeof(Condition), 1, "condition");
+  if (NULL == cond) {
+    return NULL;
+  }
+#ifdef _WIN32
+  InitializeConditionVariable(&cond->handle);
+#else // _WIN32
+  pthread_cond_init(&cond->handle, NULL);
+#endif // _WIN32
+  return cond;
+}
+
+void condition_free(Condition *cond) {
+#ifndef _WIN32
+  pthread_cond_destroy(&cond->handle);
+#endif // _WIN32
+  free_array(cond);
+}
+
+void condition_wait(Condition *cond, Mutex *mutex, int timeout_ms) {
+#ifdef _WIN32
+  SleepConditionVariableCS(&cond->handle, &mutex->handle, timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms);
+#else // _WIN32
+  if (timeout_ms < 0) {
+    pthread_cond_wait(&cond->handle, &mutex->handle);
+    return;
+  }
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec += 1;
+    deadline.tv_nsec -= 1000000000L;
+  }
+  pthread_cond_timedwait(&cond->handle, &mutex->handle, &deadline);
+#endif // _WIN32
+}
+
+void condition_broadcast(Condition *cond) {
+#ifdef _WIN32
+  WakeAllConditionVariable(&cond->handle);
+#else // _WIN32
+  pthread_cond_broadcast(&cond->handle);
+#endif // _WIN32
+}
+
+int interlocked_increment(volatile int *value) {
+#ifdef _WIN32
+  return (int)InterlockedIncrement((volatile LONG*)value);
+#else // _WIN32
+  return __sync_add_and_fetch(value, 1);
+#endif // _WIN32
+}
+
+void memory_barrier(void) {
+#ifdef _WIN32
+  MemoryBarrier();
+#else // _WIN32
+  __sync_synchronize();
+#endif // _WIN32
+}
+
+#ifdef _WIN32
+static DWORD WINAPI thread_main(LPVOID param) {
+  Thread *thread = (Thread*)param;
+  thread->func(thread->arg);
+  return 0;
+}
+#else // _WIN32
+static void * thread_main(void *param) {
+  Thread *thread = (Thread*)param;
+  thread->func(thread->arg);
+  return NULL;
+}
+#endif // _WIN32
+
+Thread * thread_start(ThreadFunction *func, void *arg) {
+  Thread *thread = malloc_array(sizeof(Thread), 1, "thread");
+  if (NULL == thread) {
+    return NULL;
+  }
+  thread->func = func;
+  thread->arg = arg;
+#ifdef _WIN32
+  thread->handle = CreateThread(NULL, 0, thread_main, thread, 0, NULL);
+  if (NULL == thread->handle) {
+    free_array(thread);
+    return NULL;
+  }
+#else // _WIN32
+  if (0 != pthread_create(&thread->handle, NULL, thread_main, thread)) {
+    free_array(thread);
+    return NULL;
+  }
+#endif // _WIN32
+  return thread;
+}
+
+void thread_join(Thread *thread) {
+#ifdef _WIN32
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+#else // _WIN32
+  pthread_join(thread->handle, NULL);
+#endif // _WIN32
+  free_array(thread);
+}